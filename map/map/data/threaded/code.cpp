@@ -0,0 +1,96 @@
+#include "map.hpp"
+#include <iostream>
+
+typedef sjtu::map<int, int, std::less<int>, sjtu::threaded_policy> Map;
+
+void print(const char *name, const Map &m) {
+	std::cout << name << ":";
+	for (Map::const_iterator it = m.cbegin(); it != m.cend(); ++it) {
+		std::cout << " " << it->first;
+	}
+	std::cout << " |";
+	if (!m.empty()) {
+		Map::const_iterator it = m.cend();
+		do {
+			--it;
+			std::cout << " " << it->first;
+		} while (it != m.cbegin());
+	}
+	std::cout << " | size " << m.size() << std::endl;
+}
+
+int main() {
+	// a node extracted from the middle of a, inserted into an empty map
+	Map a, b;
+	b.share_pool(a);
+	for (int i = 1; i <= 5; ++i) {
+		a[i] = i;
+	}
+	b.insert(a.extract(3));
+	b[10] = 10;
+	b[0] = 0;
+	print("a", a);
+	print("b", b);
+	a[3] = 30;
+	print("a", a);
+
+	// the same through a map with its own pool
+	Map c;
+	c.insert(a.extract(2));
+	c[7] = 7;
+	print("a", a);
+	print("c", c);
+
+	// merging into an empty map that shares the pool
+	Map d, e;
+	e.share_pool(d);
+	for (int i = 0; i < 8; ++i) {
+		d[i * 2] = i;
+	}
+	e.merge(d);
+	e[5] = 5;
+	print("d", d);
+	print("e", e);
+	for (int i = 0; i < 8; ++i) {
+		d[i] = i;
+	}
+	d.merge(e);
+	print("d", d);
+	print("e", e);
+
+	// extract the only element, put it back, then grow around it
+	Map f;
+	f[1] = 1;
+	f.insert(f.extract(1));
+	f[0] = 0;
+	f[2] = 2;
+	print("f", f);
+
+	// a long run of splices back and forth
+	Map g, h;
+	h.share_pool(g);
+	for (int i = 0; i < 100; ++i) {
+		g[i] = i;
+	}
+	for (int i = 0; i < 100; i += 3) {
+		h.insert(g.extract(i));
+	}
+	for (int i = 0; i < 100; i += 6) {
+		g.insert(h.extract(i));
+	}
+	long long sum = 0;
+	int count = 0;
+	for (Map::iterator it = g.end(); it != g.begin();) {
+		--it;
+		sum = sum * 3 + it->first;
+		sum %= 1000000007;
+		++count;
+	}
+	for (Map::iterator it = h.begin(); it != h.end(); ++it) {
+		sum = sum * 7 + it->first;
+		sum %= 1000000007;
+		++count;
+	}
+	std::cout << count << " " << g.size() + h.size() << " " << sum << std::endl;
+	return 0;
+}
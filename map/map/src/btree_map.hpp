@@ -0,0 +1,727 @@
+/**
+ * a container like std::map, kept in a B+ tree
+ */
+#ifndef SJTU_BTREE_MAP_HPP
+#define SJTU_BTREE_MAP_HPP
+
+#include "exceptions.hpp"
+#include "utility.hpp"
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <type_traits>
+
+namespace sjtu {
+
+/*
+  The same interface as sjtu::map, but the keys live in wide B+ tree nodes of
+about kNodeBytes, so a lookup runs a binary search inside a few contiguous
+nodes instead of chasing a pointer (and most likely a cache miss) for every
+level of a red-black tree.
+  Iterators must stay valid until their own element is erased, while the keys
+move around inside the nodes on every split, merge and shift. So each element
+is an Entry allocated on its own that never moves: the leaves hold the keys
+for searching plus a pointer to the Entry, and every Entry remembers its leaf
+and slot for iteration. The end iterator is a null Entry, and --end() walks
+down to the last leaf, just like sjtu::map's sentinel.
+*/
+template <class Key, class T, class Compare = std::less<Key>>
+class btree_map {
+public:
+  typedef pair<const Key, T> value_type;
+
+  class const_iterator;
+  class iterator;
+
+private:
+  static const size_t kNodeBytes = 512;
+  static const size_t kFitSlots = kNodeBytes / (sizeof(Key) + sizeof(void *));
+  /*Slots per node, kept even so that two nodes at the minimum fit in one.*/
+  static const int kSlots =
+      kFitSlots < 4 ? 4 : (kFitSlots > 128 ? 128 : (int)kFitSlots / 2 * 2);
+  static const int kMinSlots = kSlots / 2;
+
+  class Node;
+
+  class Entry {
+  private:
+    value_type value_;
+    Node *leaf_;
+    int index_;
+
+  public:
+    Entry(const value_type &value) : value_(value), leaf_(nullptr), index_(0) {}
+
+    friend class btree_map;
+  };
+
+  /*
+    A leaf holds count_ keys and the entries they belong to, and is chained
+  to its neighbours. An inner node holds count_ separators and count_ + 1
+  children: every key under children_[i] is less than key(i), which is not
+  greater than any key under children_[i + 1].
+  */
+  class Node {
+  private:
+    bool leaf_;
+    int count_;
+    Node *parent_;
+    Node *prev_;
+    Node *next_;
+    union {
+      Entry *entries_[kSlots];
+      Node *children_[kSlots + 1];
+    };
+    alignas(Key) unsigned char keys_[kSlots * sizeof(Key)];
+
+  public:
+    Node(bool leaf)
+        : leaf_(leaf), count_(0), parent_(nullptr), prev_(nullptr),
+          next_(nullptr) {}
+
+    ~Node() {
+      for (int i = 0; i < count_; ++i) {
+        key(i)->~Key();
+      }
+    }
+
+    Key *key(int i) { return reinterpret_cast<Key *>(keys_) + i; }
+    const Key *key(int i) const {
+      return reinterpret_cast<const Key *>(keys_) + i;
+    }
+
+    friend class btree_map;
+  };
+
+  Node *root_;
+  size_t size_;
+
+  /*Move n keys between (possibly overlapping) slots.*/
+  static void moveKeys(Node *to, int to_pos, Node *from, int from_pos, int n) {
+    if (n <= 0) {
+      return;
+    }
+    if constexpr (std::is_trivially_copyable<Key>::value) {
+      memmove((void *)to->key(to_pos), (void *)from->key(from_pos),
+              n * sizeof(Key));
+    } else {
+      if (to == from && to_pos > from_pos) {
+        for (int i = n - 1; i >= 0; --i) {
+          new (to->key(to_pos + i)) Key(*from->key(from_pos + i));
+          from->key(from_pos + i)->~Key();
+        }
+      } else {
+        for (int i = 0; i < n; ++i) {
+          new (to->key(to_pos + i)) Key(*from->key(from_pos + i));
+          from->key(from_pos + i)->~Key();
+        }
+      }
+    }
+  }
+
+  static void setKey(Node *node, int i, const Key &key) {
+    node->key(i)->~Key();
+    new (node->key(i)) Key(key);
+  }
+
+  /*Point the entries or children from slot from onwards back at node.*/
+  static void relink(Node *node, int from) {
+    if (node->leaf_) {
+      for (int i = from; i < node->count_; ++i) {
+        node->entries_[i]->leaf_ = node;
+        node->entries_[i]->index_ = i;
+      }
+    } else {
+      for (int i = from; i <= node->count_; ++i) {
+        node->children_[i]->parent_ = node;
+      }
+    }
+  }
+
+  /*The number of keys in node less than key.*/
+  static int lowerIndex(const Node *node, const Key &key) {
+    int low = 0;
+    int high = node->count_;
+    while (low < high) {
+      int mid = (low + high) / 2;
+      if (Compare{}(*node->key(mid), key)) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  }
+
+  /*The number of keys in node not greater than key.*/
+  static int upperIndex(const Node *node, const Key &key) {
+    int low = 0;
+    int high = node->count_;
+    while (low < high) {
+      int mid = (low + high) / 2;
+      if (Compare{}(key, *node->key(mid))) {
+        high = mid;
+      } else {
+        low = mid + 1;
+      }
+    }
+    return low;
+  }
+
+  Node *leafOf(const Key &key) const {
+    Node *node = root_;
+    while (!node->leaf_) {
+      node = node->children_[upperIndex(node, key)];
+    }
+    return node;
+  }
+
+  Entry *findEntry(const Key &key) const {
+    if (root_ == nullptr) {
+      return nullptr;
+    }
+    Node *leaf = leafOf(key);
+    int i = lowerIndex(leaf, key);
+    if (i < leaf->count_ && !Compare{}(key, *leaf->key(i))) {
+      return leaf->entries_[i];
+    }
+    return nullptr;
+  }
+
+  Entry *firstEntry() const {
+    if (root_ == nullptr) {
+      return nullptr;
+    }
+    Node *node = root_;
+    while (!node->leaf_) {
+      node = node->children_[0];
+    }
+    return node->entries_[0];
+  }
+
+  Entry *lastEntry() const {
+    if (root_ == nullptr) {
+      return nullptr;
+    }
+    Node *node = root_;
+    while (!node->leaf_) {
+      node = node->children_[node->count_];
+    }
+    return node->entries_[node->count_ - 1];
+  }
+
+  static Entry *nextEntry(const Entry *entry) {
+    Node *leaf = entry->leaf_;
+    if (entry->index_ + 1 < leaf->count_) {
+      return leaf->entries_[entry->index_ + 1];
+    }
+    return leaf->next_ == nullptr ? nullptr : leaf->next_->entries_[0];
+  }
+
+  static Entry *prevEntry(const Entry *entry) {
+    Node *leaf = entry->leaf_;
+    if (entry->index_ > 0) {
+      return leaf->entries_[entry->index_ - 1];
+    }
+    return leaf->prev_ == nullptr ? nullptr
+                                  : leaf->prev_->entries_[leaf->prev_->count_ - 1];
+  }
+
+  static int childIndex(const Node *parent, const Node *child) {
+    int i = 0;
+    while (parent->children_[i] != child) {
+      ++i;
+    }
+    return i;
+  }
+
+  /*Hang right, split off left, under their parent with separator key.*/
+  void insertIntoParent(Node *left, const Key &key, Node *right) {
+    Node *parent = left->parent_;
+    if (parent == nullptr) {
+      root_ = new Node(false);
+      root_->children_[0] = left;
+      root_->children_[1] = right;
+      new (root_->key(0)) Key(key);
+      root_->count_ = 1;
+      relink(root_, 0);
+      return;
+    }
+    int pos = childIndex(parent, left);
+    if (parent->count_ < kSlots) {
+      insertIntoInner(parent, pos, key, right);
+      return;
+    }
+    /*Split the full parent first: key(mid) moves up, the keys after it and
+    their children move to a new sibling.*/
+    int mid = kSlots / 2;
+    Node *sibling = new Node(false);
+    Key up(*parent->key(mid));
+    moveKeys(sibling, 0, parent, mid + 1, kSlots - mid - 1);
+    memcpy(sibling->children_, parent->children_ + mid + 1,
+           (kSlots - mid) * sizeof(Node *));
+    parent->key(mid)->~Key();
+    sibling->count_ = kSlots - mid - 1;
+    parent->count_ = mid;
+    relink(sibling, 0);
+    if (pos <= mid) {
+      insertIntoInner(parent, pos, key, right);
+    } else {
+      insertIntoInner(sibling, pos - mid - 1, key, right);
+    }
+    insertIntoParent(parent, up, sibling);
+  }
+
+  /*Put key at slot pos and child at slot pos + 1 of a node with room.*/
+  static void insertIntoInner(Node *node, int pos, const Key &key,
+                              Node *child) {
+    moveKeys(node, pos + 1, node, pos, node->count_ - pos);
+    memmove(node->children_ + pos + 2, node->children_ + pos + 1,
+            (node->count_ - pos) * sizeof(Node *));
+    new (node->key(pos)) Key(key);
+    node->children_[pos + 1] = child;
+    ++node->count_;
+    relink(node, pos + 1);
+  }
+
+  /*Put entry at slot pos of leaf, splitting it when it is full.*/
+  void insertIntoLeaf(Node *leaf, int pos, Entry *entry) {
+    if (leaf->count_ == kSlots) {
+      int mid = kSlots / 2;
+      Node *right = new Node(true);
+      moveKeys(right, 0, leaf, mid, kSlots - mid);
+      memcpy(right->entries_, leaf->entries_ + mid,
+             (kSlots - mid) * sizeof(Entry *));
+      right->count_ = kSlots - mid;
+      leaf->count_ = mid;
+      relink(right, 0);
+      right->next_ = leaf->next_;
+      if (right->next_ != nullptr) {
+        right->next_->prev_ = right;
+      }
+      right->prev_ = leaf;
+      leaf->next_ = right;
+      insertIntoParent(leaf, *right->key(0), right);
+      if (pos > mid) {
+        leaf = right;
+        pos -= mid;
+      }
+    }
+    moveKeys(leaf, pos + 1, leaf, pos, leaf->count_ - pos);
+    memmove(leaf->entries_ + pos + 1, leaf->entries_ + pos,
+            (leaf->count_ - pos) * sizeof(Entry *));
+    new (leaf->key(pos)) Key(entry->value_.first);
+    leaf->entries_[pos] = entry;
+    ++leaf->count_;
+    relink(leaf, pos);
+    ++size_;
+  }
+
+  /*
+    Refill node, which has fallen below kMinSlots, from a sibling under the
+  same parent, or merge the two when neither can spare anything. A merge
+  takes a separator out of the parent, which may then need the same.
+  */
+  void rebalance(Node *node) {
+    Node *parent = node->parent_;
+    int pos = childIndex(parent, node);
+    Node *left = pos > 0 ? parent->children_[pos - 1] : nullptr;
+    Node *right = pos < parent->count_ ? parent->children_[pos + 1] : nullptr;
+    if (left != nullptr && left->count_ > kMinSlots) {
+      borrowFromLeft(parent, pos, left, node);
+      return;
+    }
+    if (right != nullptr && right->count_ > kMinSlots) {
+      borrowFromRight(parent, pos, node, right);
+      return;
+    }
+    if (left != nullptr) {
+      merge(parent, pos - 1, left, node);
+    } else {
+      merge(parent, pos, node, right);
+    }
+    if (parent == root_) {
+      if (parent->count_ == 0) {
+        root_ = parent->children_[0];
+        root_->parent_ = nullptr;
+        delete parent;
+      }
+    } else if (parent->count_ < kMinSlots) {
+      rebalance(parent);
+    }
+  }
+
+  void borrowFromLeft(Node *parent, int pos, Node *left, Node *node) {
+    moveKeys(node, 1, node, 0, node->count_);
+    if (node->leaf_) {
+      memmove(node->entries_ + 1, node->entries_,
+              node->count_ * sizeof(Entry *));
+      moveKeys(node, 0, left, left->count_ - 1, 1);
+      node->entries_[0] = left->entries_[left->count_ - 1];
+      setKey(parent, pos - 1, *node->key(0));
+    } else {
+      memmove(node->children_ + 1, node->children_,
+              (node->count_ + 1) * sizeof(Node *));
+      new (node->key(0)) Key(*parent->key(pos - 1));
+      node->children_[0] = left->children_[left->count_];
+      setKey(parent, pos - 1, *left->key(left->count_ - 1));
+      left->key(left->count_ - 1)->~Key();
+    }
+    --left->count_;
+    ++node->count_;
+    relink(node, 0);
+  }
+
+  void borrowFromRight(Node *parent, int pos, Node *node, Node *right) {
+    if (node->leaf_) {
+      moveKeys(node, node->count_, right, 0, 1);
+      node->entries_[node->count_] = right->entries_[0];
+      moveKeys(right, 0, right, 1, right->count_ - 1);
+      memmove(right->entries_, right->entries_ + 1,
+              (right->count_ - 1) * sizeof(Entry *));
+      setKey(parent, pos, *right->key(0));
+    } else {
+      new (node->key(node->count_)) Key(*parent->key(pos));
+      node->children_[node->count_ + 1] = right->children_[0];
+      setKey(parent, pos, *right->key(0));
+      right->key(0)->~Key();
+      moveKeys(right, 0, right, 1, right->count_ - 1);
+      memmove(right->children_, right->children_ + 1,
+              right->count_ * sizeof(Node *));
+    }
+    --right->count_;
+    ++node->count_;
+    relink(node, 0);
+    relink(right, 0);
+  }
+
+  /*Fold right into left and drop separator pos of parent.*/
+  void merge(Node *parent, int pos, Node *left, Node *right) {
+    if (left->leaf_) {
+      moveKeys(left, left->count_, right, 0, right->count_);
+      memcpy(left->entries_ + left->count_, right->entries_,
+             right->count_ * sizeof(Entry *));
+      left->next_ = right->next_;
+      if (left->next_ != nullptr) {
+        left->next_->prev_ = left;
+      }
+    } else {
+      new (left->key(left->count_)) Key(*parent->key(pos));
+      ++left->count_;
+      moveKeys(left, left->count_, right, 0, right->count_);
+      memcpy(left->children_ + left->count_, right->children_,
+             (right->count_ + 1) * sizeof(Node *));
+    }
+    int old = left->count_;
+    left->count_ += right->count_;
+    right->count_ = 0;
+    relink(left, old);
+    delete right;
+    parent->key(pos)->~Key();
+    moveKeys(parent, pos, parent, pos + 1, parent->count_ - pos - 1);
+    memmove(parent->children_ + pos + 1, parent->children_ + pos + 2,
+            (parent->count_ - pos - 1) * sizeof(Node *));
+    --parent->count_;
+  }
+
+  void destroy(Node *node) {
+    if (node->leaf_) {
+      for (int i = 0; i < node->count_; ++i) {
+        delete node->entries_[i];
+      }
+    } else {
+      for (int i = 0; i <= node->count_; ++i) {
+        destroy(node->children_[i]);
+      }
+    }
+    delete node;
+  }
+
+  /*Append an element greater than all the others, for copying.*/
+  void append(const value_type &value) {
+    if (root_ == nullptr) {
+      root_ = new Node(true);
+    }
+    Node *leaf = root_;
+    while (!leaf->leaf_) {
+      leaf = leaf->children_[leaf->count_];
+    }
+    insertIntoLeaf(leaf, leaf->count_, new Entry(value));
+  }
+
+public:
+  class iterator {
+  private:
+    friend class btree_map;
+    const btree_map *it_;
+    Entry *at_;
+
+  public:
+    iterator() : it_(nullptr), at_(nullptr) {}
+    iterator(const btree_map *it, Entry *at) : it_(it), at_(at) {}
+    iterator(const iterator &other) : it_(other.it_), at_(other.at_) {}
+
+    iterator operator++(int) {
+      iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    iterator &operator++() {
+      if (it_ == nullptr || at_ == nullptr) {
+        throw invalid_iterator();
+      }
+      at_ = nextEntry(at_);
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator temp(*this);
+      --*this;
+      return temp;
+    }
+    iterator &operator--() {
+      if (it_ == nullptr) {
+        throw invalid_iterator();
+      }
+      Entry *prev = at_ == nullptr ? it_->lastEntry() : prevEntry(at_);
+      if (prev == nullptr) {
+        throw invalid_iterator();
+      }
+      at_ = prev;
+      return *this;
+    }
+
+    value_type &operator*() const { return at_->value_; }
+    value_type *operator->() const noexcept { return &at_->value_; }
+
+    bool operator==(const iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator==(const const_iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  class const_iterator {
+  private:
+    friend class btree_map;
+    const btree_map *it_;
+    const Entry *at_;
+
+  public:
+    const_iterator() : it_(nullptr), at_(nullptr) {}
+    const_iterator(const btree_map *it, const Entry *at) : it_(it), at_(at) {}
+    const_iterator(const const_iterator &other)
+        : it_(other.it_), at_(other.at_) {}
+    const_iterator(const iterator &other) : it_(other.it_), at_(other.at_) {}
+
+    const_iterator operator++(int) {
+      const_iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    const_iterator &operator++() {
+      if (it_ == nullptr || at_ == nullptr) {
+        throw invalid_iterator();
+      }
+      at_ = nextEntry(at_);
+      return *this;
+    }
+    const_iterator operator--(int) {
+      const_iterator temp(*this);
+      --*this;
+      return temp;
+    }
+    const_iterator &operator--() {
+      if (it_ == nullptr) {
+        throw invalid_iterator();
+      }
+      const Entry *prev = at_ == nullptr ? it_->lastEntry() : prevEntry(at_);
+      if (prev == nullptr) {
+        throw invalid_iterator();
+      }
+      at_ = prev;
+      return *this;
+    }
+
+    const value_type &operator*() const { return at_->value_; }
+    const value_type *operator->() const noexcept { return &at_->value_; }
+
+    bool operator==(const iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator==(const const_iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  btree_map() : root_(nullptr), size_(0) {}
+
+  btree_map(const btree_map &other) : root_(nullptr), size_(0) {
+    for (const Entry *entry = other.firstEntry(); entry != nullptr;
+         entry = nextEntry(entry)) {
+      append(entry->value_);
+    }
+  }
+
+  btree_map &operator=(const btree_map &other) {
+    if (this == &other) {
+      return *this;
+    }
+    clear();
+    for (const Entry *entry = other.firstEntry(); entry != nullptr;
+         entry = nextEntry(entry)) {
+      append(entry->value_);
+    }
+    return *this;
+  }
+
+  ~btree_map() { clear(); }
+
+  T &at(const Key &key) {
+    Entry *entry = findEntry(key);
+    if (entry == nullptr) {
+      throw index_out_of_bound();
+    }
+    return entry->value_.second;
+  }
+  const T &at(const Key &key) const {
+    Entry *entry = findEntry(key);
+    if (entry == nullptr) {
+      throw index_out_of_bound();
+    }
+    return entry->value_.second;
+  }
+
+  T &operator[](const Key &key) {
+    Entry *entry = findEntry(key);
+    if (entry != nullptr) {
+      return entry->value_.second;
+    }
+    return insert(value_type(key, T())).first->second;
+  }
+
+  /*behave like at() throw index_out_of_bound if such key does not exist.*/
+  const T &operator[](const Key &key) const { return at(key); }
+
+  iterator begin() { return iterator(this, firstEntry()); }
+  const_iterator cbegin() const { return const_iterator(this, firstEntry()); }
+  iterator end() { return iterator(this, nullptr); }
+  const_iterator cend() const { return const_iterator(this, nullptr); }
+
+  bool empty() const { return size_ == 0; }
+
+  size_t size() const { return size_; }
+
+  void clear() {
+    if (root_ != nullptr) {
+      destroy(root_);
+    }
+    root_ = nullptr;
+    size_ = 0;
+  }
+
+  /**
+   * insert an element.
+   * return a pair, the first of the pair is
+   *   the iterator to the new element (or the element that prevented the
+   * insertion), the second one is true if insert successfully, or false.
+   */
+  pair<iterator, bool> insert(const value_type &value) {
+    if (root_ == nullptr) {
+      root_ = new Node(true);
+    }
+    Node *leaf = leafOf(value.first);
+    int pos = lowerIndex(leaf, value.first);
+    if (pos < leaf->count_ && !Compare{}(value.first, *leaf->key(pos))) {
+      return pair<iterator, bool>(iterator(this, leaf->entries_[pos]), false);
+    }
+    Entry *entry = new Entry(value);
+    insertIntoLeaf(leaf, pos, entry);
+    return pair<iterator, bool>(iterator(this, entry), true);
+  }
+
+  /**
+   * erase the element at pos.
+   *
+   * throw if pos pointed to a bad element (pos == this->end() || pos points
+   * an element out of this)
+   */
+  void erase(iterator pos) {
+    if (pos.it_ != this || pos.at_ == nullptr) {
+      throw invalid_iterator();
+    }
+    Entry *entry = pos.at_;
+    Node *leaf = entry->leaf_;
+    int i = entry->index_;
+    leaf->key(i)->~Key();
+    moveKeys(leaf, i, leaf, i + 1, leaf->count_ - i - 1);
+    memmove(leaf->entries_ + i, leaf->entries_ + i + 1,
+            (leaf->count_ - i - 1) * sizeof(Entry *));
+    --leaf->count_;
+    relink(leaf, i);
+    delete entry;
+    --size_;
+    if (leaf == root_) {
+      if (leaf->count_ == 0) {
+        delete root_;
+        root_ = nullptr;
+      }
+    } else if (leaf->count_ < kMinSlots) {
+      rebalance(leaf);
+    }
+  }
+
+  /**
+   * Returns the number of elements with key
+   *   that compares equivalent to the specified argument,
+   *   which is either 1 or 0
+   *     since this container does not allow duplicates.
+   */
+  size_t count(const Key &key) const { return findEntry(key) != nullptr; }
+
+  iterator find(const Key &key) { return iterator(this, findEntry(key)); }
+  const_iterator find(const Key &key) const {
+    return const_iterator(this, findEntry(key));
+  }
+
+  /*The first element not less than key; the leaf holding it, or the one
+  right before it, is found by the same descent as for a lookup.*/
+  iterator lower_bound(const Key &key) {
+    return iterator(this, boundEntry(key, false));
+  }
+  const_iterator lower_bound(const Key &key) const {
+    return const_iterator(this, boundEntry(key, false));
+  }
+  iterator upper_bound(const Key &key) {
+    return iterator(this, boundEntry(key, true));
+  }
+  const_iterator upper_bound(const Key &key) const {
+    return const_iterator(this, boundEntry(key, true));
+  }
+
+private:
+  Entry *boundEntry(const Key &key, bool upper) const {
+    if (root_ == nullptr) {
+      return nullptr;
+    }
+    Node *leaf = leafOf(key);
+    int i = upper ? upperIndex(leaf, key) : lowerIndex(leaf, key);
+    if (i < leaf->count_) {
+      return leaf->entries_[i];
+    }
+    return leaf->next_ == nullptr ? nullptr : leaf->next_->entries_[0];
+  }
+};
+
+} // namespace sjtu
+
+#endif
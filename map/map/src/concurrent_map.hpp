@@ -0,0 +1,216 @@
+/**
+ * an ordered map for many readers and few writers
+ */
+#ifndef SJTU_CONCURRENT_MAP_HPP
+#define SJTU_CONCURRENT_MAP_HPP
+
+#include "exceptions.hpp"
+#include "persistent_map.hpp"
+#include "utility.hpp"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+
+namespace sjtu {
+
+/*
+  A map shared by many threads that mostly read it. Readers never lock: they
+read the version of the map published last, a persistent_map nobody writes.
+Writers take turns on a mutex, change a private version of their own (which
+copies only the path to the change, see persistent_map), and publish a
+snapshot of it with one atomic store.
+  A replaced version is retired, not freed, since readers may still be in it.
+Reclamation is epoch based, with the two-counter scheme of userspace RCU: a
+reader adds itself to the counter of the current epoch parity in its slot for
+the duration of its read, and a writer about to free retired versions flips
+the epoch twice, each time waiting for the counters of the parity it left to
+drain. Anyone still reading by then started after the retired versions were
+replaced, so cannot see them. Writers free retired versions in batches of
+kRetireBatch, which spreads one grace period over that many writes.
+  Slots are cache-line sized and picked by thread, so readers on different
+cores do not write to the same line; threads that share a slot just add to
+the same counters.
+*/
+template <class Key, class T, class Compare = std::less<Key>>
+class concurrent_map {
+public:
+  typedef persistent_map<Key, T, Compare> version_type;
+  typedef typename version_type::value_type value_type;
+
+private:
+  static const size_t kCacheLine = 64;
+  static const int kSlots = 64;
+  static const int kRetireBatch = 32;
+
+  struct alignas(kCacheLine) Slot {
+    std::atomic<long> readers_[2];
+    Slot() {
+      readers_[0].store(0, std::memory_order_relaxed);
+      readers_[1].store(0, std::memory_order_relaxed);
+    }
+  };
+
+  mutable Slot slots_[kSlots];
+  alignas(kCacheLine) std::atomic<unsigned long> epoch_;
+  std::atomic<const version_type *> current_;
+  alignas(kCacheLine) std::mutex write_;
+  version_type working_;
+  const version_type *retired_[kRetireBatch];
+  int retired_num_;
+
+  static Slot &slotOf(Slot *slots) {
+    static std::atomic<unsigned> next_thread(0);
+    thread_local unsigned index =
+        next_thread.fetch_add(1, std::memory_order_relaxed) % kSlots;
+    return slots[index];
+  }
+
+  /*Wait until every reader that may have seen a retired version is gone.*/
+  void synchronize() {
+    for (int flip = 0; flip < 2; ++flip) {
+      unsigned long parity = epoch_.fetch_add(1, std::memory_order_seq_cst) & 1;
+      for (int i = 0; i < kSlots; ++i) {
+        while (slots_[i].readers_[parity].load(std::memory_order_acquire) !=
+               0) {
+          std::this_thread::yield();
+        }
+      }
+    }
+  }
+
+  /*Publish working_ and retire the version it replaces. The caller holds
+  write_.*/
+  void publish() {
+    const version_type *next = new version_type(working_.snapshot());
+    const version_type *old =
+        current_.exchange(next, std::memory_order_seq_cst);
+    retired_[retired_num_++] = old;
+    if (retired_num_ == kRetireBatch) {
+      synchronize();
+      for (int i = 0; i < retired_num_; ++i) {
+        delete retired_[i];
+      }
+      retired_num_ = 0;
+    }
+  }
+
+public:
+  concurrent_map() : epoch_(0), current_(new version_type()), retired_num_(0) {}
+  explicit concurrent_map(const Compare &comp)
+      : epoch_(0), current_(new version_type(comp)), working_(comp),
+        retired_num_(0) {}
+
+  concurrent_map(const concurrent_map &) = delete;
+  concurrent_map &operator=(const concurrent_map &) = delete;
+
+  /*No reader or writer may be left when the map goes.*/
+  ~concurrent_map() {
+    for (int i = 0; i < retired_num_; ++i) {
+      delete retired_[i];
+    }
+    delete current_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * run f on the version published last, without taking any lock, and
+   * return what it returns. The version does not change while f runs, so
+   * several lookups or a whole iteration in f see the same map; nothing it
+   * refers to may be kept after f returns.
+   */
+  template <class F> auto read(F &&f) const {
+    Slot &slot = slotOf(slots_);
+    unsigned long parity = epoch_.load(std::memory_order_seq_cst) & 1;
+    slot.readers_[parity].fetch_add(1, std::memory_order_seq_cst);
+    struct Leave {
+      std::atomic<long> &readers;
+      ~Leave() { readers.fetch_sub(1, std::memory_order_release); }
+    } leave{slot.readers_[parity]};
+    return f(*current_.load(std::memory_order_seq_cst));
+  }
+
+  /**
+   * the version published last, to be read at leisure: it stays as it is,
+   * and alive, for as long as the copy does. O(1).
+   */
+  version_type snapshot() const {
+    return read([](const version_type &version) { return version; });
+  }
+
+  /*Copy the value with key into value and return true, or return false.*/
+  bool find(const Key &key, T &value) const {
+    return read([&](const version_type &version) {
+      typename version_type::const_iterator it = version.find(key);
+      if (it == version.cend()) {
+        return false;
+      }
+      value = it->second;
+      return true;
+    });
+  }
+
+  /*The value with key, by value; throw index_out_of_bound if there is
+  none.*/
+  T at(const Key &key) const {
+    return read([&](const version_type &version) { return version.at(key); });
+  }
+
+  size_t count(const Key &key) const {
+    return read(
+        [&](const version_type &version) { return version.count(key); });
+  }
+
+  size_t size() const {
+    return read([](const version_type &version) { return version.size(); });
+  }
+
+  bool empty() const { return size() == 0; }
+
+  /**
+   * run f on the private version of the writers, then publish it, all under
+   * the writer lock: the changes f makes show up together. f gets a
+   * persistent_map& and may change it any way it likes.
+   */
+  template <class F> void update(F &&f) {
+    std::lock_guard<std::mutex> lock(write_);
+    f(working_);
+    publish();
+  }
+
+  bool insert(const value_type &value) {
+    std::lock_guard<std::mutex> lock(write_);
+    if (!working_.insert(value)) {
+      return false;
+    }
+    publish();
+    return true;
+  }
+
+  bool insert_or_assign(const Key &key, const T &obj) {
+    std::lock_guard<std::mutex> lock(write_);
+    bool inserted = working_.insert_or_assign(key, obj);
+    publish();
+    return inserted;
+  }
+
+  size_t erase(const Key &key) {
+    std::lock_guard<std::mutex> lock(write_);
+    if (working_.erase(key) == 0) {
+      return 0;
+    }
+    publish();
+    return 1;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(write_);
+    working_.clear();
+    publish();
+  }
+};
+
+} // namespace sjtu
+
+#endif
@@ -0,0 +1,642 @@
+/**
+ * an ordered map that many threads may read and change at once
+ */
+#ifndef SJTU_CONCURRENT_SKIPLIST_MAP_HPP
+#define SJTU_CONCURRENT_SKIPLIST_MAP_HPP
+
+#include "exceptions.hpp"
+#include "map.hpp"
+#include "utility.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+
+namespace sjtu {
+
+/*
+  A lock-free skiplist [Pugh 1990], for workloads where writers are too many
+to take turns as they do in concurrent_map. Every level of a node's tower is
+a link of a sorted list, and all changes are compare-and-swaps on the links
+[Fraser 2004; Herlihy & Shavit, ch. 14]. Insertion links the bottom level
+first, which makes the element present, then the levels above. Erasure marks
+the node's links from the top down, setting the low bit of each pointer so
+that nothing can be linked after the node any more; whoever marks the bottom
+level has erased the element. Marked nodes are then unlinked by any search
+that passes them.
+  An unlinked node may still be in use by threads that reached it before,
+so it is retired and freed later, with epoch based reclamation [Fraser 2004]:
+a thread works on the map pinned to the epoch it read when it started, by
+adding itself to that epoch's counter in its slot. The epoch moves on once no
+one is pinned to the one before it, and a node retired in epoch e is freed
+once the epoch reaches e + 2, by when everyone that could have seen it is
+gone. Threads retire into the list of their slot and free what has become
+safe in it every kCollectEvery retirements.
+  A node is retired only when both its inserter and its eraser are done with
+it, since an erase may overtake an insertion that is still linking the upper
+levels, which then has to unlink what it linked.
+  Iterators are forward only and weakly consistent: they see every element
+present for the whole walk, none twice and in order, and maybe some that come
+and go meanwhile. An iterator keeps its thread pinned while it lives, and so
+holds back reclamation; do not keep one for long. Elements are read only,
+since a reader cannot know who else reads them. size() is exact only when no
+one changes the map.
+*/
+template <class Key, class T, class Compare = std::less<Key>>
+class concurrent_skiplist_map : private map_compare_holder<Compare> {
+public:
+  typedef pair<const Key, T> value_type;
+
+  class const_iterator;
+
+private:
+  using map_compare_holder<Compare>::comp;
+
+  /*With a quarter of the nodes going up each level, enough for 4^16.*/
+  static const int kMaxLevel = 16;
+  static const size_t kCacheLine = 64;
+  static const int kSlots = 64;
+  static const int kCollectEvery = 64;
+
+  class Node {
+  public:
+    std::atomic<Node *> *next_;
+    int level_;
+    /*The inserter and the eraser; the last one out retires the node.*/
+    std::atomic<int> owners_;
+    Node *retired_next_;
+    unsigned long retired_epoch_;
+    alignas(value_type) unsigned char value_[sizeof(value_type)];
+
+    value_type &value() { return *reinterpret_cast<value_type *>(value_); }
+    const Key &key() { return value().first; }
+  };
+
+  /*A pointer with the low bit set is a marked link: its node is erased.*/
+  static bool isMarked(Node *link) {
+    return (reinterpret_cast<uintptr_t>(link) & 1) != 0;
+  }
+  static Node *marked(Node *link) {
+    return reinterpret_cast<Node *>(reinterpret_cast<uintptr_t>(link) | 1);
+  }
+  static Node *unmarked(Node *link) {
+    return reinterpret_cast<Node *>(reinterpret_cast<uintptr_t>(link) &
+                                    ~uintptr_t(1));
+  }
+
+  struct alignas(kCacheLine) Slot {
+    std::atomic<long> pinned_[3];
+    std::atomic<Node *> retired_;
+    std::atomic<int> retired_num_;
+    Slot() : retired_(nullptr), retired_num_(0) {
+      for (int i = 0; i < 3; ++i) {
+        pinned_[i].store(0, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  mutable Slot slots_[kSlots];
+  alignas(kCacheLine) std::atomic<unsigned long> epoch_;
+  Node *head_;
+  alignas(kCacheLine) std::atomic<size_t> size_;
+
+  static Slot &slotOf(Slot *slots) {
+    static std::atomic<unsigned> next_thread(0);
+    thread_local unsigned index =
+        next_thread.fetch_add(1, std::memory_order_relaxed) % kSlots;
+    return slots[index];
+  }
+
+  /*The tower lives right after the node, in the same block.*/
+  static Node *allocateNode(int level) {
+    void *raw = ::operator new(sizeof(Node) +
+                               level * sizeof(std::atomic<Node *>));
+    Node *node = new (raw) Node;
+    node->next_ = reinterpret_cast<std::atomic<Node *> *>(node + 1);
+    for (int i = 0; i < level; ++i) {
+      new (&node->next_[i]) std::atomic<Node *>(nullptr);
+    }
+    node->level_ = level;
+    node->owners_.store(2, std::memory_order_relaxed);
+    return node;
+  }
+  static Node *createNode(int level, const value_type &value) {
+    Node *node = allocateNode(level);
+    try {
+      new (node->value_) value_type(value);
+    } catch (...) {
+      ::operator delete(node);
+      throw;
+    }
+    return node;
+  }
+  static void destroyNode(Node *node) {
+    node->value().~value_type();
+    ::operator delete(node);
+  }
+
+  static int randomLevel() {
+    thread_local unsigned state = 0;
+    if (state == 0) {
+      static std::atomic<unsigned> seed(2463534242u);
+      state = seed.fetch_add(0x9e3779b9u, std::memory_order_relaxed) | 1;
+    }
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    unsigned bits = state;
+    int level = 1;
+    while (level < kMaxLevel && (bits & 3) == 0) {
+      ++level;
+      bits >>= 2;
+    }
+    return level;
+  }
+
+  /*Pin the calling thread to the current epoch and return its counter. The
+  epoch is read again after counting in, so that it cannot have moved on
+  twice unseen in between.*/
+  std::atomic<long> *pin() const {
+    Slot &slot = slotOf(slots_);
+    while (true) {
+      unsigned long epoch = epoch_.load(std::memory_order_seq_cst);
+      std::atomic<long> *pinned = &slot.pinned_[epoch % 3];
+      pinned->fetch_add(1, std::memory_order_seq_cst);
+      if (epoch_.load(std::memory_order_seq_cst) == epoch) {
+        return pinned;
+      }
+      pinned->fetch_sub(1, std::memory_order_release);
+    }
+  }
+  static void unpin(std::atomic<long> *pinned) {
+    pinned->fetch_sub(1, std::memory_order_release);
+  }
+
+  class Pin {
+  private:
+    std::atomic<long> *pinned_;
+
+  public:
+    explicit Pin(const concurrent_skiplist_map *map) : pinned_(map->pin()) {}
+    Pin(const Pin &) = delete;
+    Pin &operator=(const Pin &) = delete;
+    ~Pin() { unpin(pinned_); }
+    std::atomic<long> *counter() const { return pinned_; }
+  };
+
+  /*Move the epoch on from e if no one is pinned to e - 1 any more: everyone
+  pinned is then at e, and the epoch can be e + 1 for them.*/
+  void tryAdvance() {
+    unsigned long epoch = epoch_.load(std::memory_order_seq_cst);
+    int before = (epoch + 2) % 3;
+    for (int i = 0; i < kSlots; ++i) {
+      if (slots_[i].pinned_[before].load(std::memory_order_acquire) != 0) {
+        return;
+      }
+    }
+    epoch_.compare_exchange_strong(epoch, epoch + 1,
+                                   std::memory_order_seq_cst);
+  }
+
+  /*Free what has become safe in the retired list of slot and put the rest
+  back.*/
+  void collect(Slot &slot) {
+    slot.retired_num_.store(0, std::memory_order_relaxed);
+    tryAdvance();
+    unsigned long epoch = epoch_.load(std::memory_order_seq_cst);
+    Node *list = slot.retired_.exchange(nullptr, std::memory_order_acquire);
+    Node *kept = nullptr;
+    Node *kept_last = nullptr;
+    while (list != nullptr) {
+      Node *next = list->retired_next_;
+      if (list->retired_epoch_ + 2 <= epoch) {
+        destroyNode(list);
+      } else {
+        if (kept == nullptr) {
+          kept_last = list;
+        }
+        list->retired_next_ = kept;
+        kept = list;
+      }
+      list = next;
+    }
+    if (kept != nullptr) {
+      Node *head = slot.retired_.load(std::memory_order_relaxed);
+      do {
+        kept_last->retired_next_ = head;
+      } while (!slot.retired_.compare_exchange_weak(
+          head, kept, std::memory_order_release, std::memory_order_relaxed));
+    }
+  }
+
+  /*The caller is pinned, and node is unlinked from every level.*/
+  void retire(Node *node) {
+    Slot &slot = slotOf(slots_);
+    node->retired_epoch_ = epoch_.load(std::memory_order_seq_cst);
+    Node *head = slot.retired_.load(std::memory_order_relaxed);
+    do {
+      node->retired_next_ = head;
+    } while (!slot.retired_.compare_exchange_weak(
+        head, node, std::memory_order_release, std::memory_order_relaxed));
+    if (slot.retired_num_.fetch_add(1, std::memory_order_relaxed) + 1 >=
+        kCollectEvery) {
+      collect(slot);
+    }
+  }
+
+  void releaseOwner(Node *node) {
+    if (node->owners_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      retire(node);
+    }
+  }
+
+  /*
+    Fill preds and succs with the nodes around key on every level, unlinking
+  the marked nodes met on the way, and return the element with key, or
+  nullptr. A failed unlink means the predecessor changed under us, so the
+  search starts over.
+  */
+  Node *search(const Key &key, Node **preds, Node **succs) {
+  retry:
+    Node *pred = head_;
+    for (int i = kMaxLevel - 1; i >= 0; --i) {
+      Node *curr = pred->next_[i].load(std::memory_order_acquire);
+      while (true) {
+        if (isMarked(curr)) {
+          goto retry;
+        }
+        if (curr == nullptr) {
+          break;
+        }
+        Node *succ = curr->next_[i].load(std::memory_order_acquire);
+        if (isMarked(succ)) {
+          Node *expected = curr;
+          if (!pred->next_[i].compare_exchange_strong(
+                  expected, unmarked(succ), std::memory_order_acq_rel)) {
+            goto retry;
+          }
+          curr = unmarked(succ);
+          continue;
+        }
+        if (!comp()(curr->key(), key)) {
+          break;
+        }
+        pred = curr;
+        curr = succ;
+      }
+      preds[i] = pred;
+      succs[i] = curr;
+    }
+    if (succs[0] != nullptr && !comp()(key, succs[0]->key())) {
+      return succs[0];
+    }
+    return nullptr;
+  }
+
+  /*The first unmarked node from node on along the bottom level.*/
+  static Node *firstLive(Node *node) {
+    while (node != nullptr) {
+      Node *next = node->next_[0].load(std::memory_order_acquire);
+      if (!isMarked(next)) {
+        return node;
+      }
+      node = unmarked(next);
+    }
+    return nullptr;
+  }
+
+  /*The first element not less than key, or greater than key for upper; a
+  read-only search that steps over marked nodes instead of unlinking them.*/
+  Node *boundOf(const Key &key, bool upper) const {
+    Node *pred = head_;
+    Node *curr = nullptr;
+    for (int i = kMaxLevel - 1; i >= 0; --i) {
+      curr = unmarked(pred->next_[i].load(std::memory_order_acquire));
+      while (curr != nullptr) {
+        Node *succ = curr->next_[i].load(std::memory_order_acquire);
+        if (isMarked(succ)) {
+          curr = unmarked(succ);
+          continue;
+        }
+        bool right =
+            upper ? !comp()(key, curr->key()) : comp()(curr->key(), key);
+        if (!right) {
+          break;
+        }
+        pred = curr;
+        curr = succ;
+      }
+    }
+    return curr;
+  }
+
+  Node *findNode(const Key &key) const {
+    Node *node = boundOf(key, false);
+    if (node == nullptr || comp()(key, node->key())) {
+      return nullptr;
+    }
+    return node;
+  }
+
+  /*Link node into level i between preds[i] and succs[i], searching again
+  while they change. false if node got erased meanwhile.*/
+  bool linkLevel(Node *node, int i, Node **preds, Node **succs) {
+    while (true) {
+      Node *next = node->next_[i].load(std::memory_order_acquire);
+      if (isMarked(next)) {
+        return false;
+      }
+      if (next != succs[i] &&
+          !node->next_[i].compare_exchange_strong(
+              next, succs[i], std::memory_order_acq_rel)) {
+        return false;
+      }
+      Node *succ = succs[i];
+      if (preds[i]->next_[i].compare_exchange_strong(
+              succ, node, std::memory_order_acq_rel)) {
+        return true;
+      }
+      if (search(node->key(), preds, succs) != node) {
+        return false;
+      }
+    }
+  }
+
+  /*Mark node from the top level down and unlink it. true if this call
+  erased it, false if someone else did first. The caller is pinned.*/
+  bool unlinkNode(Node *node) {
+    for (int i = node->level_ - 1; i >= 0; --i) {
+      Node *next = node->next_[i].load(std::memory_order_acquire);
+      while (!isMarked(next)) {
+        if (node->next_[i].compare_exchange_weak(
+                next, marked(next), std::memory_order_acq_rel)) {
+          break;
+        }
+      }
+      if (i == 0 && isMarked(next)) {
+        return false;
+      }
+    }
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    Node *preds[kMaxLevel];
+    Node *succs[kMaxLevel];
+    search(node->key(), preds, succs);
+    releaseOwner(node);
+    return true;
+  }
+
+public:
+  /**
+   * a forward iterator. While it lives, the nodes it can reach are not
+   * freed; see the class comment.
+   */
+  class const_iterator {
+  private:
+    friend class concurrent_skiplist_map;
+    const concurrent_skiplist_map *map_;
+    Node *node_;
+    std::atomic<long> *pinned_;
+
+    const_iterator(const concurrent_skiplist_map *map, Node *node,
+                   std::atomic<long> *pinned)
+        : map_(map), node_(node), pinned_(pinned) {
+      if (pinned_ != nullptr) {
+        pinned_->fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+  public:
+    const_iterator() : map_(nullptr), node_(nullptr), pinned_(nullptr) {}
+    /*A copy shares the pin, which is enough: the epoch cannot move past it
+    while the original holds it.*/
+    const_iterator(const const_iterator &other)
+        : const_iterator(other.map_, other.node_, other.pinned_) {}
+    const_iterator &operator=(const const_iterator &other) {
+      if (other.pinned_ != nullptr) {
+        other.pinned_->fetch_add(1, std::memory_order_relaxed);
+      }
+      if (pinned_ != nullptr) {
+        unpin(pinned_);
+      }
+      map_ = other.map_;
+      node_ = other.node_;
+      pinned_ = other.pinned_;
+      return *this;
+    }
+    ~const_iterator() {
+      if (pinned_ != nullptr) {
+        unpin(pinned_);
+      }
+    }
+
+    const_iterator operator++(int) {
+      const_iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    /*From an element erased meanwhile too: its links still lead on.*/
+    const_iterator &operator++() {
+      if (node_ == nullptr) {
+        throw invalid_iterator();
+      }
+      node_ = firstLive(
+          unmarked(node_->next_[0].load(std::memory_order_acquire)));
+      return *this;
+    }
+
+    const value_type &operator*() const { return node_->value(); }
+    const value_type *operator->() const noexcept {
+      return &node_->value();
+    }
+
+    bool operator==(const const_iterator &rhs) const {
+      return map_ == rhs.map_ && node_ == rhs.node_;
+    }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  concurrent_skiplist_map() { init(); }
+  explicit concurrent_skiplist_map(const Compare &comp)
+      : map_compare_holder<Compare>(comp) {
+    init();
+  }
+
+  concurrent_skiplist_map(const concurrent_skiplist_map &) = delete;
+  concurrent_skiplist_map &
+  operator=(const concurrent_skiplist_map &) = delete;
+
+  /*No one may be using the map, or hold an iterator into it, when it
+  goes.*/
+  ~concurrent_skiplist_map() {
+    Node *node = unmarked(head_->next_[0].load(std::memory_order_relaxed));
+    while (node != nullptr) {
+      Node *next = unmarked(node->next_[0].load(std::memory_order_relaxed));
+      destroyNode(node);
+      node = next;
+    }
+    for (int i = 0; i < kSlots; ++i) {
+      node = slots_[i].retired_.load(std::memory_order_relaxed);
+      while (node != nullptr) {
+        Node *next = node->retired_next_;
+        destroyNode(node);
+        node = next;
+      }
+    }
+    ::operator delete(head_);
+  }
+
+  /*The value with key, by value; throw index_out_of_bound if there is
+  none.*/
+  T at(const Key &key) const {
+    Pin pin(this);
+    Node *node = findNode(key);
+    if (node == nullptr) {
+      throw index_out_of_bound();
+    }
+    return node->value().second;
+  }
+
+  const_iterator begin() const { return cbegin(); }
+  const_iterator cbegin() const {
+    Pin pin(this);
+    return const_iterator(
+        this,
+        firstLive(unmarked(head_->next_[0].load(std::memory_order_acquire))),
+        pin.counter());
+  }
+  const_iterator end() const { return cend(); }
+  const_iterator cend() const { return const_iterator(this, nullptr, nullptr); }
+
+  bool empty() const { return size() == 0; }
+
+  size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+  /*Erase every element, one by one: not atomic with respect to others.*/
+  void clear() {
+    Pin pin(this);
+    Node *node;
+    while ((node = firstLive(unmarked(
+                head_->next_[0].load(std::memory_order_acquire)))) !=
+           nullptr) {
+      unlinkNode(node);
+    }
+  }
+
+  /**
+   * insert an element.
+   * return a pair, the first of which is an iterator to the element with the
+   * key of value, and the second is whether it was inserted.
+   */
+  pair<const_iterator, bool> insert(const value_type &value) {
+    Pin pin(this);
+    Node *preds[kMaxLevel];
+    Node *succs[kMaxLevel];
+    int level = randomLevel();
+    Node *node = nullptr;
+    while (true) {
+      Node *found = search(value.first, preds, succs);
+      if (found != nullptr) {
+        if (node != nullptr) {
+          destroyNode(node);
+        }
+        return pair<const_iterator, bool>(
+            const_iterator(this, found, pin.counter()), false);
+      }
+      if (node == nullptr) {
+        node = createNode(level, value);
+      }
+      for (int i = 0; i < level; ++i) {
+        node->next_[i].store(succs[i], std::memory_order_relaxed);
+      }
+      Node *succ = succs[0];
+      if (preds[0]->next_[0].compare_exchange_strong(
+              succ, node, std::memory_order_acq_rel)) {
+        break;
+      }
+    }
+    size_.fetch_add(1, std::memory_order_relaxed);
+    for (int i = 1; i < level; ++i) {
+      if (!linkLevel(node, i, preds, succs)) {
+        break;
+      }
+    }
+    /*An erase that came in while we linked may have searched before some
+    of our links; unlink them ourselves.*/
+    if (isMarked(node->next_[0].load(std::memory_order_acquire))) {
+      search(node->key(), preds, succs);
+    }
+    const_iterator it(this, node, pin.counter());
+    releaseOwner(node);
+    return pair<const_iterator, bool>(it, true);
+  }
+
+  /**
+   * erase the element with key, if there is one, and return the number of
+   * elements erased (0 or 1).
+   */
+  size_t erase(const Key &key) {
+    Pin pin(this);
+    Node *preds[kMaxLevel];
+    Node *succs[kMaxLevel];
+    while (true) {
+      Node *node = search(key, preds, succs);
+      if (node == nullptr) {
+        return 0;
+      }
+      if (unlinkNode(node)) {
+        return 1;
+      }
+    }
+  }
+
+  /**
+   * erase the element pos points to, unless someone else has already.
+   * throw invalid_iterator if pos is end() or into another map.
+   */
+  void erase(const_iterator pos) {
+    if (pos.map_ != this || pos.node_ == nullptr) {
+      throw invalid_iterator();
+    }
+    Pin pin(this);
+    unlinkNode(pos.node_);
+  }
+
+  size_t count(const Key &key) const {
+    Pin pin(this);
+    return findNode(key) != nullptr;
+  }
+
+  /**
+   * Finds an element with key equivalent to key.
+   * Iterator to the element, or end() if there is none.
+   */
+  const_iterator find(const Key &key) const {
+    Pin pin(this);
+    return const_iterator(this, findNode(key), pin.counter());
+  }
+
+  /*The first element not less than key, or greater than key for
+  upper_bound().*/
+  const_iterator lower_bound(const Key &key) const {
+    Pin pin(this);
+    return const_iterator(this, boundOf(key, false), pin.counter());
+  }
+  const_iterator upper_bound(const Key &key) const {
+    Pin pin(this);
+    return const_iterator(this, boundOf(key, true), pin.counter());
+  }
+
+private:
+  void init() {
+    epoch_.store(0, std::memory_order_relaxed);
+    size_.store(0, std::memory_order_relaxed);
+    head_ = allocateNode(kMaxLevel);
+  }
+};
+
+} // namespace sjtu
+
+#endif
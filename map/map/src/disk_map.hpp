@@ -0,0 +1,890 @@
+/**
+ * an ordered map kept in a memory-mapped file
+ */
+#ifndef SJTU_DISK_MAP_HPP
+#define SJTU_DISK_MAP_HPP
+
+#include "exceptions.hpp"
+#include "map.hpp"
+#include "utility.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+namespace sjtu {
+
+/*
+  An ordered map that lives in a file, so it survives the process: opening
+one that is already there is O(1) whatever its size, where rebuilding a map
+costs an insert per element. (It is not the persistent_map, whose versions
+persist in memory.) The file is mapped into memory whole, and the kernel
+reads each page in the first time it is touched; a few lookups after a
+restart read only the pages on their paths.
+  The elements are kept in a B+ tree of kPageBytes pages, laid out like
+btree_map's nodes but with the keys and values themselves in the leaves.
+Page 0 is a Header: the tree's root, the ends of the leaf chain, the size,
+and a free list of the pages given back by erasures. Nodes refer to each
+other by page number, not by address, since the mapping moves when the file
+grows (it doubles) and is at a different address in the next process. So Key
+and T must be trivially copyable and hold no pointers, and a file must be
+opened with the Key, T and Compare it was built with: the header records the
+sizes and refuses a file whose sizes do not match, but it cannot check the
+types or the order.
+  Changes are written to the mapping, which the kernel writes back to the
+file in its own time; flush() waits until everything is on disk. A crash in
+the middle of a change can leave a file with only some of its pages written.
+  As in flat_map, iterators yield pair<const Key &, T &>, and any insertion
+or erasure invalidates all iterators.
+*/
+template <class Key, class T, class Compare = std::less<Key>>
+class disk_map : private map_compare_holder<Compare> {
+public:
+  typedef pair<const Key, T> value_type;
+  typedef pair<const Key &, T &> reference;
+  typedef pair<const Key &, const T &> const_reference;
+
+  class const_iterator;
+  class iterator;
+
+private:
+  using map_compare_holder<Compare>::comp;
+
+  static_assert(std::is_trivially_copyable<Key>::value &&
+                    std::is_trivially_copyable<T>::value,
+                "disk_map stores Key and T as raw bytes");
+
+  static const size_t kPageBytes = 4096;
+  static const std::uint64_t kMagic = 0x70616d6b7369646aULL;
+  static const std::uint32_t kVersion = 1;
+  static const std::uint64_t kInitialPages = 16;
+  /*Deeper than any tree of pages with at least two children each.*/
+  static const int kMaxDepth = 64;
+
+  struct Header {
+    std::uint64_t magic_;
+    std::uint32_t version_;
+    std::uint32_t page_bytes_;
+    std::uint32_t key_bytes_;
+    std::uint32_t value_bytes_;
+    std::uint64_t pages_;
+    std::uint64_t free_;
+    std::uint64_t root_;
+    std::uint64_t first_;
+    std::uint64_t last_;
+    std::uint64_t size_;
+  };
+
+  /*
+    The start of every node page. A leaf holds count_ keys and their values
+  and is chained to its neighbours, page 0 standing for none. An inner node
+  holds count_ separators and count_ + 1 children: every key under child i
+  is less than key i, which is not greater than any key under child i + 1.
+  */
+  struct Node {
+    std::uint32_t leaf_;
+    std::uint32_t count_;
+    std::uint64_t prev_;
+    std::uint64_t next_;
+  };
+
+  static const size_t kKeysAt =
+      (sizeof(Node) + alignof(Key) - 1) / alignof(Key) * alignof(Key);
+  static const int kLeafSlots =
+      (int)((kPageBytes - kKeysAt - alignof(T)) / (sizeof(Key) + sizeof(T)));
+  static const int kInnerSlots =
+      (int)((kPageBytes - kKeysAt - alignof(std::uint64_t) -
+             sizeof(std::uint64_t)) /
+            (sizeof(Key) + sizeof(std::uint64_t)));
+  static const size_t kValuesAt =
+      (kKeysAt + kLeafSlots * sizeof(Key) + alignof(T) - 1) / alignof(T) *
+      alignof(T);
+  static const size_t kChildrenAt =
+      (kKeysAt + kInnerSlots * sizeof(Key) + alignof(std::uint64_t) - 1) /
+      alignof(std::uint64_t) * alignof(std::uint64_t);
+  static const int kLeafMin = kLeafSlots / 2;
+  static const int kInnerMin = kInnerSlots / 2;
+
+  static_assert(kLeafSlots >= 4 && kInnerSlots >= 4,
+                "Key and T must fit at least four to a page");
+
+  int fd_;
+  char *base_;
+  std::uint64_t capacity_;
+
+  Header *header() const { return reinterpret_cast<Header *>(base_); }
+  Node *node(std::uint64_t page) const {
+    return reinterpret_cast<Node *>(base_ + page * kPageBytes);
+  }
+  Key *keys(std::uint64_t page) const {
+    return reinterpret_cast<Key *>(base_ + page * kPageBytes + kKeysAt);
+  }
+  T *values(std::uint64_t page) const {
+    return reinterpret_cast<T *>(base_ + page * kPageBytes + kValuesAt);
+  }
+  std::uint64_t *children(std::uint64_t page) const {
+    return reinterpret_cast<std::uint64_t *>(base_ + page * kPageBytes +
+                                             kChildrenAt);
+  }
+
+  void mapFile(std::uint64_t pages) {
+    void *base = ::mmap(nullptr, pages * kPageBytes, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd_, 0);
+    if (base == MAP_FAILED) {
+      throw runtime_error();
+    }
+    base_ = static_cast<char *>(base);
+    capacity_ = pages;
+  }
+
+  /*Grow the file to hold at least pages pages. Every address into the
+  mapping is stale afterwards; page numbers stay good.*/
+  void reserve(std::uint64_t pages) {
+    if (pages <= capacity_) {
+      return;
+    }
+    std::uint64_t grown = capacity_ * 2 < pages ? pages : capacity_ * 2;
+    if (::ftruncate(fd_, (off_t)(grown * kPageBytes)) != 0) {
+      throw runtime_error();
+    }
+    ::munmap(base_, capacity_ * kPageBytes);
+    base_ = nullptr;
+    mapFile(grown);
+  }
+
+  /*A page off the free list or past the last one in use. As it may grow
+  the file, callers hold page numbers across it, not addresses.*/
+  std::uint64_t allocate(bool leaf) {
+    std::uint64_t page = header()->free_;
+    if (page != 0) {
+      std::memcpy(&header()->free_, node(page), sizeof(std::uint64_t));
+    } else {
+      reserve(header()->pages_ + 1);
+      page = header()->pages_++;
+    }
+    Node *target = node(page);
+    target->leaf_ = leaf;
+    target->count_ = 0;
+    target->prev_ = target->next_ = 0;
+    return page;
+  }
+
+  void release(std::uint64_t page) {
+    std::memcpy(node(page), &header()->free_, sizeof(std::uint64_t));
+    header()->free_ = page;
+  }
+
+  /*The number of keys in page less than key.*/
+  int lowerIndex(std::uint64_t page, const Key &key) const {
+    const Key *at = keys(page);
+    int low = 0;
+    int high = (int)node(page)->count_;
+    while (low < high) {
+      int mid = (low + high) / 2;
+      if (comp()(at[mid], key)) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  }
+
+  /*The number of keys in page not greater than key.*/
+  int upperIndex(std::uint64_t page, const Key &key) const {
+    const Key *at = keys(page);
+    int low = 0;
+    int high = (int)node(page)->count_;
+    while (low < high) {
+      int mid = (low + high) / 2;
+      if (comp()(key, at[mid])) {
+        high = mid;
+      } else {
+        low = mid + 1;
+      }
+    }
+    return low;
+  }
+
+  /*The way down to the leaf for key: the inner pages passed and which child
+  was taken in each.*/
+  struct Path {
+    std::uint64_t pages[kMaxDepth];
+    int slots[kMaxDepth];
+    int depth;
+  };
+
+  std::uint64_t leafOf(const Key &key, Path *path) const {
+    std::uint64_t page = header()->root_;
+    if (path != nullptr) {
+      path->depth = 0;
+    }
+    while (!node(page)->leaf_) {
+      int slot = upperIndex(page, key);
+      if (path != nullptr) {
+        path->pages[path->depth] = page;
+        path->slots[path->depth++] = slot;
+      }
+      page = children(page)[slot];
+    }
+    return page;
+  }
+
+  /*The leaf and slot of key, or page 0 when it is missing.*/
+  pair<std::uint64_t, int> findSlot(const Key &key) const {
+    if (header()->root_ == 0) {
+      return pair<std::uint64_t, int>(0, 0);
+    }
+    std::uint64_t leaf = leafOf(key, nullptr);
+    int slot = lowerIndex(leaf, key);
+    if (slot < (int)node(leaf)->count_ && !comp()(key, keys(leaf)[slot])) {
+      return pair<std::uint64_t, int>(leaf, slot);
+    }
+    return pair<std::uint64_t, int>(0, 0);
+  }
+
+  pair<std::uint64_t, int> boundSlot(const Key &key, bool upper) const {
+    if (header()->root_ == 0) {
+      return pair<std::uint64_t, int>(0, 0);
+    }
+    std::uint64_t leaf = leafOf(key, nullptr);
+    int slot = upper ? upperIndex(leaf, key) : lowerIndex(leaf, key);
+    if (slot < (int)node(leaf)->count_) {
+      return pair<std::uint64_t, int>(leaf, slot);
+    }
+    return pair<std::uint64_t, int>(node(leaf)->next_, 0);
+  }
+
+  /*
+    Hang right, split off left, under the parent path ends in with
+  separator key, splitting full parents on the way up. A full node is split
+  through a buffer one slot longer: the keys and children go there with the
+  new ones in place, and are cut in two from it.
+  */
+  void insertIntoParent(Path &path, std::uint64_t left, Key key,
+                        std::uint64_t right) {
+    while (path.depth != 0) {
+      --path.depth;
+      std::uint64_t parent = path.pages[path.depth];
+      int pos = path.slots[path.depth];
+      int count = (int)node(parent)->count_;
+      if (count < kInnerSlots) {
+        Key *at = keys(parent);
+        std::uint64_t *child = children(parent);
+        std::memmove(at + pos + 1, at + pos, (count - pos) * sizeof(Key));
+        std::memmove(child + pos + 2, child + pos + 1,
+                     (count - pos) * sizeof(std::uint64_t));
+        at[pos] = key;
+        child[pos + 1] = right;
+        ++node(parent)->count_;
+        return;
+      }
+      alignas(Key) unsigned char bytes[(kInnerSlots + 1) * sizeof(Key)];
+      Key *buffer = reinterpret_cast<Key *>(bytes);
+      std::uint64_t links[kInnerSlots + 2];
+      std::memcpy(buffer, keys(parent), pos * sizeof(Key));
+      std::memcpy(buffer + pos, &key, sizeof(Key));
+      std::memcpy(buffer + pos + 1, keys(parent) + pos,
+                  (count - pos) * sizeof(Key));
+      std::memcpy(links, children(parent), (pos + 1) * sizeof(std::uint64_t));
+      links[pos + 1] = right;
+      std::memcpy(links + pos + 2, children(parent) + pos + 1,
+                  (count - pos) * sizeof(std::uint64_t));
+      std::uint64_t sibling = allocate(false);
+      int mid = (kInnerSlots + 1) / 2;
+      std::memcpy(keys(parent), buffer, mid * sizeof(Key));
+      std::memcpy(children(parent), links, (mid + 1) * sizeof(std::uint64_t));
+      node(parent)->count_ = mid;
+      int rest = kInnerSlots - mid;
+      std::memcpy(keys(sibling), buffer + mid + 1, rest * sizeof(Key));
+      std::memcpy(children(sibling), links + mid + 1,
+                  (rest + 1) * sizeof(std::uint64_t));
+      node(sibling)->count_ = rest;
+      left = parent;
+      key = buffer[mid];
+      right = sibling;
+    }
+    std::uint64_t root = allocate(false);
+    keys(root)[0] = key;
+    children(root)[0] = left;
+    children(root)[1] = right;
+    node(root)->count_ = 1;
+    header()->root_ = root;
+  }
+
+  /*Put key and value at slot pos of leaf, splitting it when it is full, and
+  return where they ended up.*/
+  pair<std::uint64_t, int> insertIntoLeaf(Path &path, std::uint64_t leaf,
+                                          int pos, const Key &key,
+                                          const T &value) {
+    int count = (int)node(leaf)->count_;
+    ++header()->size_;
+    if (count < kLeafSlots) {
+      std::memmove(keys(leaf) + pos + 1, keys(leaf) + pos,
+                   (count - pos) * sizeof(Key));
+      std::memmove(values(leaf) + pos + 1, values(leaf) + pos,
+                   (count - pos) * sizeof(T));
+      keys(leaf)[pos] = key;
+      values(leaf)[pos] = value;
+      ++node(leaf)->count_;
+      return pair<std::uint64_t, int>(leaf, pos);
+    }
+    std::uint64_t right = allocate(true);
+    int mid = (kLeafSlots + 1) / 2;
+    if (pos < mid) {
+      std::memcpy(keys(right), keys(leaf) + mid - 1,
+                  (count - mid + 1) * sizeof(Key));
+      std::memcpy(values(right), values(leaf) + mid - 1,
+                  (count - mid + 1) * sizeof(T));
+      node(leaf)->count_ = mid - 1;
+      node(right)->count_ = count - mid + 1;
+    } else {
+      std::memcpy(keys(right), keys(leaf) + mid, (count - mid) * sizeof(Key));
+      std::memcpy(values(right), values(leaf) + mid,
+                  (count - mid) * sizeof(T));
+      node(leaf)->count_ = mid;
+      node(right)->count_ = count - mid;
+    }
+    std::uint64_t next = node(leaf)->next_;
+    node(right)->next_ = next;
+    node(right)->prev_ = leaf;
+    node(leaf)->next_ = right;
+    if (next != 0) {
+      node(next)->prev_ = right;
+    } else {
+      header()->last_ = right;
+    }
+    --header()->size_;
+    pair<std::uint64_t, int> at =
+        pos < mid ? insertIntoLeaf(path, leaf, pos, key, value)
+                  : insertIntoLeaf(path, right, pos - mid, key, value);
+    insertIntoParent(path, leaf, keys(right)[0], right);
+    return at;
+  }
+
+  void borrowFromLeft(std::uint64_t parent, int pos, std::uint64_t left,
+                      std::uint64_t page) {
+    int count = (int)node(page)->count_;
+    int spare = (int)node(left)->count_ - 1;
+    std::memmove(keys(page) + 1, keys(page), count * sizeof(Key));
+    if (node(page)->leaf_) {
+      std::memmove(values(page) + 1, values(page), count * sizeof(T));
+      keys(page)[0] = keys(left)[spare];
+      values(page)[0] = values(left)[spare];
+      keys(parent)[pos - 1] = keys(page)[0];
+    } else {
+      std::memmove(children(page) + 1, children(page),
+                   (count + 1) * sizeof(std::uint64_t));
+      keys(page)[0] = keys(parent)[pos - 1];
+      children(page)[0] = children(left)[spare + 1];
+      keys(parent)[pos - 1] = keys(left)[spare];
+    }
+    --node(left)->count_;
+    ++node(page)->count_;
+  }
+
+  void borrowFromRight(std::uint64_t parent, int pos, std::uint64_t page,
+                       std::uint64_t right) {
+    int count = (int)node(page)->count_;
+    int rest = (int)node(right)->count_ - 1;
+    if (node(page)->leaf_) {
+      keys(page)[count] = keys(right)[0];
+      values(page)[count] = values(right)[0];
+      std::memmove(keys(right), keys(right) + 1, rest * sizeof(Key));
+      std::memmove(values(right), values(right) + 1, rest * sizeof(T));
+      keys(parent)[pos] = keys(right)[0];
+    } else {
+      keys(page)[count] = keys(parent)[pos];
+      children(page)[count + 1] = children(right)[0];
+      keys(parent)[pos] = keys(right)[0];
+      std::memmove(keys(right), keys(right) + 1, rest * sizeof(Key));
+      std::memmove(children(right), children(right) + 1,
+                   (rest + 1) * sizeof(std::uint64_t));
+    }
+    --node(right)->count_;
+    ++node(page)->count_;
+  }
+
+  /*Fold right into left, drop separator pos of parent and free right.*/
+  void merge(std::uint64_t parent, int pos, std::uint64_t left,
+             std::uint64_t right) {
+    int count = (int)node(left)->count_;
+    int more = (int)node(right)->count_;
+    if (node(left)->leaf_) {
+      std::memcpy(keys(left) + count, keys(right), more * sizeof(Key));
+      std::memcpy(values(left) + count, values(right), more * sizeof(T));
+      std::uint64_t next = node(right)->next_;
+      node(left)->next_ = next;
+      if (next != 0) {
+        node(next)->prev_ = left;
+      } else {
+        header()->last_ = left;
+      }
+    } else {
+      keys(left)[count++] = keys(parent)[pos];
+      std::memcpy(keys(left) + count, keys(right), more * sizeof(Key));
+      std::memcpy(children(left) + count, children(right),
+                  (more + 1) * sizeof(std::uint64_t));
+    }
+    node(left)->count_ = count + more;
+    release(right);
+    int rest = (int)node(parent)->count_ - pos - 1;
+    std::memmove(keys(parent) + pos, keys(parent) + pos + 1,
+                 rest * sizeof(Key));
+    std::memmove(children(parent) + pos + 1, children(parent) + pos + 2,
+                 rest * sizeof(std::uint64_t));
+    --node(parent)->count_;
+  }
+
+  /*
+    Refill page, which has fallen below its minimum, from a sibling under
+  the same parent, or merge the two when neither can spare anything. A merge
+  takes a separator out of the parent, which may then need the same, up to
+  the root, which is dropped once it has a single child left.
+  */
+  void rebalance(Path &path, std::uint64_t page) {
+    while (path.depth != 0) {
+      --path.depth;
+      std::uint64_t parent = path.pages[path.depth];
+      int pos = path.slots[path.depth];
+      int least = node(page)->leaf_ ? kLeafMin : kInnerMin;
+      if ((int)node(page)->count_ >= least) {
+        return;
+      }
+      std::uint64_t left = pos > 0 ? children(parent)[pos - 1] : 0;
+      std::uint64_t right =
+          pos < (int)node(parent)->count_ ? children(parent)[pos + 1] : 0;
+      if (left != 0 && (int)node(left)->count_ > least) {
+        borrowFromLeft(parent, pos, left, page);
+        return;
+      }
+      if (right != 0 && (int)node(right)->count_ > least) {
+        borrowFromRight(parent, pos, page, right);
+        return;
+      }
+      if (left != 0) {
+        merge(parent, pos - 1, left, page);
+      } else {
+        merge(parent, pos, page, right);
+      }
+      page = parent;
+    }
+    if (!node(page)->leaf_ && node(page)->count_ == 0) {
+      header()->root_ = children(page)[0];
+      release(page);
+    }
+  }
+
+  void eraseAt(Path &path, std::uint64_t leaf, int slot) {
+    int rest = (int)node(leaf)->count_ - slot - 1;
+    std::memmove(keys(leaf) + slot, keys(leaf) + slot + 1, rest * sizeof(Key));
+    std::memmove(values(leaf) + slot, values(leaf) + slot + 1,
+                 rest * sizeof(T));
+    --node(leaf)->count_;
+    --header()->size_;
+    if (leaf == header()->root_) {
+      if (node(leaf)->count_ == 0) {
+        release(leaf);
+        header()->root_ = header()->first_ = header()->last_ = 0;
+      }
+      return;
+    }
+    rebalance(path, leaf);
+  }
+
+  /*Step a (page, slot) position forwards or backwards; page 0 is the
+  end.*/
+  void next(std::uint64_t &page, int &slot) const {
+    if (slot + 1 < (int)node(page)->count_) {
+      ++slot;
+    } else {
+      page = node(page)->next_;
+      slot = 0;
+    }
+  }
+  bool prev(std::uint64_t &page, int &slot) const {
+    if (page == 0) {
+      if (header()->last_ == 0) {
+        return false;
+      }
+      page = header()->last_;
+      slot = (int)node(page)->count_ - 1;
+    } else if (slot > 0) {
+      --slot;
+    } else {
+      if (node(page)->prev_ == 0) {
+        return false;
+      }
+      page = node(page)->prev_;
+      slot = (int)node(page)->count_ - 1;
+    }
+    return true;
+  }
+
+public:
+  class iterator {
+  private:
+    friend class disk_map;
+    const disk_map *it_;
+    std::uint64_t page_;
+    int slot_;
+
+    /*What operator-> returns: it holds the pair of references.*/
+    class Arrow {
+    private:
+      reference ref_;
+
+    public:
+      explicit Arrow(const reference &ref) : ref_(ref) {}
+      const reference *operator->() const { return &ref_; }
+    };
+
+  public:
+    iterator() : it_(nullptr), page_(0), slot_(0) {}
+    iterator(const disk_map *it, std::uint64_t page, int slot)
+        : it_(it), page_(page), slot_(slot) {}
+    iterator(const iterator &other)
+        : it_(other.it_), page_(other.page_), slot_(other.slot_) {}
+
+    iterator operator++(int) {
+      iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    iterator &operator++() {
+      if (it_ == nullptr || page_ == 0) {
+        throw invalid_iterator();
+      }
+      it_->next(page_, slot_);
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator temp(*this);
+      --*this;
+      return temp;
+    }
+    iterator &operator--() {
+      if (it_ == nullptr || !it_->prev(page_, slot_)) {
+        throw invalid_iterator();
+      }
+      return *this;
+    }
+
+    reference operator*() const {
+      return reference(it_->keys(page_)[slot_], it_->values(page_)[slot_]);
+    }
+    Arrow operator->() const { return Arrow(**this); }
+
+    bool operator==(const iterator &rhs) const {
+      return it_ == rhs.it_ && page_ == rhs.page_ && slot_ == rhs.slot_;
+    }
+    bool operator==(const const_iterator &rhs) const {
+      return it_ == rhs.it_ && page_ == rhs.page_ && slot_ == rhs.slot_;
+    }
+    bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  class const_iterator {
+  private:
+    friend class disk_map;
+    const disk_map *it_;
+    std::uint64_t page_;
+    int slot_;
+
+    class Arrow {
+    private:
+      const_reference ref_;
+
+    public:
+      explicit Arrow(const const_reference &ref) : ref_(ref) {}
+      const const_reference *operator->() const { return &ref_; }
+    };
+
+  public:
+    const_iterator() : it_(nullptr), page_(0), slot_(0) {}
+    const_iterator(const disk_map *it, std::uint64_t page, int slot)
+        : it_(it), page_(page), slot_(slot) {}
+    const_iterator(const const_iterator &other)
+        : it_(other.it_), page_(other.page_), slot_(other.slot_) {}
+    const_iterator(const iterator &other)
+        : it_(other.it_), page_(other.page_), slot_(other.slot_) {}
+
+    const_iterator operator++(int) {
+      const_iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    const_iterator &operator++() {
+      if (it_ == nullptr || page_ == 0) {
+        throw invalid_iterator();
+      }
+      it_->next(page_, slot_);
+      return *this;
+    }
+    const_iterator operator--(int) {
+      const_iterator temp(*this);
+      --*this;
+      return temp;
+    }
+    const_iterator &operator--() {
+      if (it_ == nullptr || !it_->prev(page_, slot_)) {
+        throw invalid_iterator();
+      }
+      return *this;
+    }
+
+    const_reference operator*() const {
+      return const_reference(it_->keys(page_)[slot_],
+                             it_->values(page_)[slot_]);
+    }
+    Arrow operator->() const { return Arrow(**this); }
+
+    bool operator==(const iterator &rhs) const {
+      return it_ == rhs.it_ && page_ == rhs.page_ && slot_ == rhs.slot_;
+    }
+    bool operator==(const const_iterator &rhs) const {
+      return it_ == rhs.it_ && page_ == rhs.page_ && slot_ == rhs.slot_;
+    }
+    bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  /**
+   * open the map in the file at path, or start an empty one there if the
+   * file is missing or empty. O(1): nothing is read until it is needed.
+   * Throw runtime_error if the file cannot be opened or mapped, or was not
+   * written by a disk_map with the same sizes of Key and T.
+   */
+  explicit disk_map(const char *path, const Compare &comp = Compare())
+      : map_compare_holder<Compare>(comp), fd_(-1), base_(nullptr),
+        capacity_(0) {
+    fd_ = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0) {
+      throw runtime_error();
+    }
+    try {
+      struct stat status;
+      if (::fstat(fd_, &status) != 0) {
+        throw runtime_error();
+      }
+      std::uint64_t bytes = (std::uint64_t)status.st_size;
+      if (bytes == 0) {
+        if (::ftruncate(fd_, (off_t)(kInitialPages * kPageBytes)) != 0) {
+          throw runtime_error();
+        }
+        mapFile(kInitialPages);
+        Header *head = header();
+        head->magic_ = kMagic;
+        head->version_ = kVersion;
+        head->page_bytes_ = kPageBytes;
+        head->key_bytes_ = sizeof(Key);
+        head->value_bytes_ = sizeof(T);
+        head->pages_ = 1;
+        head->free_ = head->root_ = head->first_ = head->last_ = 0;
+        head->size_ = 0;
+        return;
+      }
+      if (bytes % kPageBytes != 0) {
+        throw runtime_error();
+      }
+      mapFile(bytes / kPageBytes);
+      const Header *head = header();
+      if (head->magic_ != kMagic || head->version_ != kVersion ||
+          head->page_bytes_ != kPageBytes || head->key_bytes_ != sizeof(Key) ||
+          head->value_bytes_ != sizeof(T) || head->pages_ > capacity_) {
+        throw runtime_error();
+      }
+    } catch (...) {
+      if (base_ != nullptr) {
+        ::munmap(base_, capacity_ * kPageBytes);
+      }
+      ::close(fd_);
+      throw;
+    }
+  }
+
+  disk_map(const disk_map &) = delete;
+  disk_map &operator=(const disk_map &) = delete;
+
+  /*Unmap and close the file. What has not been flush()ed is still written
+  back by the kernel, unless the machine goes down first.*/
+  ~disk_map() {
+    ::munmap(base_, capacity_ * kPageBytes);
+    ::close(fd_);
+  }
+
+  /**
+   * write every change made so far to the disk and wait until it is there
+   * (msync, then fsync for the file's size). Throw runtime_error if that
+   * fails.
+   */
+  void flush() {
+    if (::msync(base_, capacity_ * kPageBytes, MS_SYNC) != 0 ||
+        ::fsync(fd_) != 0) {
+      throw runtime_error();
+    }
+  }
+
+  /**
+   * access specified element with bounds checking
+   * Returns a reference to the mapped value of the element with key
+   * equivalent to key. If no such element exists, an exception of type
+   * `index_out_of_bound' is thrown. The reference is good until the next
+   * insertion or erasure.
+   */
+  T &at(const Key &key) {
+    pair<std::uint64_t, int> at = findSlot(key);
+    if (at.first == 0) {
+      throw index_out_of_bound();
+    }
+    return values(at.first)[at.second];
+  }
+  const T &at(const Key &key) const {
+    pair<std::uint64_t, int> at = findSlot(key);
+    if (at.first == 0) {
+      throw index_out_of_bound();
+    }
+    return values(at.first)[at.second];
+  }
+
+  /*The value with key, value-initialised and inserted if missing.*/
+  T &operator[](const Key &key) {
+    iterator it = insert(value_type(key, T())).first;
+    return values(it.page_)[it.slot_];
+  }
+
+  /*behave like at() throw index_out_of_bound if such key does not exist.*/
+  const T &operator[](const Key &key) const { return at(key); }
+
+  iterator begin() { return iterator(this, header()->first_, 0); }
+  const_iterator cbegin() const {
+    return const_iterator(this, header()->first_, 0);
+  }
+  iterator end() { return iterator(this, 0, 0); }
+  const_iterator cend() const { return const_iterator(this, 0, 0); }
+
+  bool empty() const { return header()->size_ == 0; }
+
+  size_t size() const { return header()->size_; }
+
+  /*Drop every element. The pages are kept in the file for reuse.*/
+  void clear() {
+    Header *head = header();
+    head->pages_ = 1;
+    head->free_ = head->root_ = head->first_ = head->last_ = 0;
+    head->size_ = 0;
+  }
+
+  /**
+   * insert an element.
+   * return a pair, the first of the pair is
+   *   the iterator to the new element (or the element that prevented the
+   * insertion), the second one is true if insert successfully, or false.
+   */
+  pair<iterator, bool> insert(const value_type &value) {
+    if (header()->root_ == 0) {
+      std::uint64_t leaf = allocate(true);
+      header()->root_ = header()->first_ = header()->last_ = leaf;
+    }
+    Path path;
+    std::uint64_t leaf = leafOf(value.first, &path);
+    int slot = lowerIndex(leaf, value.first);
+    if (slot < (int)node(leaf)->count_ &&
+        !comp()(value.first, keys(leaf)[slot])) {
+      return pair<iterator, bool>(iterator(this, leaf, slot), false);
+    }
+    pair<std::uint64_t, int> at =
+        insertIntoLeaf(path, leaf, slot, value.first, value.second);
+    return pair<iterator, bool>(iterator(this, at.first, at.second), true);
+  }
+
+  /*Set the value of key to obj, inserting it if missing; return whether it
+  was inserted.*/
+  bool insert_or_assign(const Key &key, const T &obj) {
+    pair<iterator, bool> result = insert(value_type(key, obj));
+    if (!result.second) {
+      values(result.first.page_)[result.first.slot_] = obj;
+    }
+    return result.second;
+  }
+
+  /**
+   * erase the element at pos.
+   *
+   * throw if pos pointed to a bad element (pos == this->end() || pos points
+   * an element out of this)
+   */
+  void erase(iterator pos) {
+    if (pos.it_ != this || pos.page_ == 0) {
+      throw invalid_iterator();
+    }
+    Path path;
+    std::uint64_t leaf = leafOf(keys(pos.page_)[pos.slot_], &path);
+    eraseAt(path, leaf, pos.slot_);
+  }
+
+  /*Erase the element with key, if any; return how many were erased.*/
+  size_t erase(const Key &key) {
+    if (header()->root_ == 0) {
+      return 0;
+    }
+    Path path;
+    std::uint64_t leaf = leafOf(key, &path);
+    int slot = lowerIndex(leaf, key);
+    if (slot == (int)node(leaf)->count_ || comp()(key, keys(leaf)[slot])) {
+      return 0;
+    }
+    eraseAt(path, leaf, slot);
+    return 1;
+  }
+
+  /**
+   * Returns the number of elements with key
+   *   that compares equivalent to the specified argument,
+   *   which is either 1 or 0
+   *     since this container does not allow duplicates.
+   */
+  size_t count(const Key &key) const { return findSlot(key).first != 0; }
+
+  iterator find(const Key &key) {
+    pair<std::uint64_t, int> at = findSlot(key);
+    return iterator(this, at.first, at.second);
+  }
+  const_iterator find(const Key &key) const {
+    pair<std::uint64_t, int> at = findSlot(key);
+    return const_iterator(this, at.first, at.second);
+  }
+
+  /*The first element not less than key, or greater than key for
+  upper_bound().*/
+  iterator lower_bound(const Key &key) {
+    pair<std::uint64_t, int> at = boundSlot(key, false);
+    return iterator(this, at.first, at.second);
+  }
+  const_iterator lower_bound(const Key &key) const {
+    pair<std::uint64_t, int> at = boundSlot(key, false);
+    return const_iterator(this, at.first, at.second);
+  }
+  iterator upper_bound(const Key &key) {
+    pair<std::uint64_t, int> at = boundSlot(key, true);
+    return iterator(this, at.first, at.second);
+  }
+  const_iterator upper_bound(const Key &key) const {
+    pair<std::uint64_t, int> at = boundSlot(key, true);
+    return const_iterator(this, at.first, at.second);
+  }
+};
+
+} // namespace sjtu
+
+#endif
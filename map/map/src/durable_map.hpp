@@ -0,0 +1,494 @@
+/**
+ * a map whose changes are logged to disk
+ */
+#ifndef SJTU_DURABLE_MAP_HPP
+#define SJTU_DURABLE_MAP_HPP
+
+#include "exceptions.hpp"
+#include "map.hpp"
+#include "utility.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <unistd.h>
+
+namespace sjtu {
+
+/*
+  A sjtu::map that survives a crash. Every change is applied to the map and
+appended, as a short binary record, to a write-ahead log at path + ".wal":
+a put (key and value) or an erase (key), or a clear. Records are committed
+in groups: they collect in memory and go to the log with one write and one
+fdatasync once there are kGroupBytes of them, or on commit(). A change is
+durable once its group is committed, so many changes share the cost of one
+sync; the destructor commits what is left.
+  checkpoint() writes the whole map to path + ".snapshot" in one sequential
+pass in key order, syncs it, renames it into place and empties the log. On
+opening, the snapshot is loaded with assign_sorted(), in O(n) as it is
+already sorted, and the groups of the log are replayed on top of it.
+  Each group carries its length and a checksum, so a group cut short by a
+crash in the middle of a commit is recognised and dropped, with everything
+after it, and the log is cut back to the last whole group. The snapshot and
+the log both carry an epoch, which checkpoint() advances, and a log newer
+than the snapshot means the snapshot is lost. A log older than the snapshot,
+left by a crash between the rename and the emptying, is replayed all the
+same: every record sets its key to what it became, or clears the map, so
+replaying records the snapshot already has changes nothing.
+  Key and T are written as raw bytes, so they must be trivially copyable and
+hold no pointers, and the files must be reopened with the same Key, T and
+Compare. Reading goes through contents(); changing the map only through
+durable_map, so that nothing escapes the log. operator[] returns a proxy
+whose assignment is logged.
+*/
+template <class Key, class T, class Compare = std::less<Key>,
+          class Policy = map_policy<>>
+class durable_map {
+public:
+  typedef map<Key, T, Compare, Policy> map_type;
+  typedef typename map_type::value_type value_type;
+  typedef typename map_type::const_iterator const_iterator;
+
+  class reference;
+
+private:
+  static_assert(std::is_trivially_copyable<Key>::value &&
+                    std::is_trivially_copyable<T>::value,
+                "durable_map writes Key and T as raw bytes");
+
+  static const std::uint64_t kSnapshotMagic = 0x70616e736c627264ULL;
+  static const std::uint64_t kLogMagic = 0x676f6c6c62617264ULL;
+  static const std::uint32_t kVersion = 1;
+  static const size_t kGroupBytes = 64 * 1024;
+
+  static const unsigned char kPut = 1;
+  static const unsigned char kErase = 2;
+  static const unsigned char kClear = 3;
+
+  /*The start of both files; count is the number of elements that follow
+  in a snapshot, and 0 in the log.*/
+  struct FileHeader {
+    std::uint64_t magic_;
+    std::uint32_t version_;
+    std::uint32_t key_bytes_;
+    std::uint32_t value_bytes_;
+    std::uint32_t unused_;
+    std::uint64_t epoch_;
+    std::uint64_t count_;
+  };
+
+  /*The start of every group of records in the log.*/
+  struct GroupHeader {
+    std::uint64_t bytes_;
+    std::uint64_t checksum_;
+  };
+
+  map_type map_;
+  std::string path_;
+  int log_;
+  std::uint64_t epoch_;
+  std::string group_;
+
+  /*FNV-1a: enough to tell a torn group from a whole one.*/
+  static std::uint64_t checksum(const char *data, size_t n) {
+    std::uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; ++i) {
+      hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+  }
+
+  FileHeader header(std::uint64_t magic, std::uint64_t count) const {
+    FileHeader head;
+    std::memset(&head, 0, sizeof(head));
+    head.magic_ = magic;
+    head.version_ = kVersion;
+    head.key_bytes_ = sizeof(Key);
+    head.value_bytes_ = sizeof(T);
+    head.epoch_ = epoch_;
+    head.count_ = count;
+    return head;
+  }
+
+  static bool matches(const FileHeader &head, std::uint64_t magic) {
+    return head.magic_ == magic && head.version_ == kVersion &&
+           head.key_bytes_ == sizeof(Key) && head.value_bytes_ == sizeof(T);
+  }
+
+  static void writeAll(int fd, const char *data, size_t n) {
+    while (n != 0) {
+      ssize_t done = ::write(fd, data, n);
+      if (done < 0) {
+        throw runtime_error();
+      }
+      data += done;
+      n -= (size_t)done;
+    }
+  }
+
+  /*Read up to n bytes; fewer only at the end of the file.*/
+  static size_t readAll(int fd, char *data, size_t n) {
+    size_t total = 0;
+    while (total != n) {
+      ssize_t done = ::read(fd, data + total, n - total);
+      if (done < 0) {
+        throw runtime_error();
+      }
+      if (done == 0) {
+        break;
+      }
+      total += (size_t)done;
+    }
+    return total;
+  }
+
+  static void syncDirectoryOf(const std::string &path) {
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos
+                                ? std::string(".")
+                                : path.substr(0, slash == 0 ? 1 : slash);
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw runtime_error();
+    }
+    int failed = ::fsync(fd);
+    ::close(fd);
+    if (failed != 0) {
+      throw runtime_error();
+    }
+  }
+
+  void append(unsigned char op, const Key *key, const T *value) {
+    group_.push_back((char)op);
+    if (key != nullptr) {
+      group_.append(reinterpret_cast<const char *>(key), sizeof(Key));
+    }
+    if (value != nullptr) {
+      group_.append(reinterpret_cast<const char *>(value), sizeof(T));
+    }
+    if (group_.size() >= kGroupBytes) {
+      commit();
+    }
+  }
+
+  /*
+    Reads a snapshot's elements one after another, for assign_sorted(): an
+  input iterator over the file, equal to the end once count elements have
+  been read.
+  */
+  class Loader {
+  private:
+    std::FILE *file_;
+    std::uint64_t left_;
+    alignas(Key) unsigned char key_[sizeof(Key)];
+    alignas(T) unsigned char value_[sizeof(T)];
+
+    void read() {
+      if (std::fread(key_, sizeof(Key), 1, file_) != 1 ||
+          std::fread(value_, sizeof(T), 1, file_) != 1) {
+        throw runtime_error();
+      }
+    }
+
+  public:
+    Loader(std::FILE *file, std::uint64_t left) : file_(file), left_(left) {
+      if (left_ != 0) {
+        read();
+      }
+    }
+
+    value_type operator*() const {
+      return value_type(*reinterpret_cast<const Key *>(key_),
+                        *reinterpret_cast<const T *>(value_));
+    }
+    Loader &operator++() {
+      if (--left_ != 0) {
+        read();
+      }
+      return *this;
+    }
+    bool operator==(const Loader &rhs) const { return left_ == rhs.left_; }
+    bool operator!=(const Loader &rhs) const { return left_ != rhs.left_; }
+  };
+
+  /*Load the snapshot, if there is one, and take its epoch.*/
+  void loadSnapshot() {
+    std::string name = path_ + ".snapshot";
+    std::FILE *file = std::fopen(name.c_str(), "rb");
+    if (file == nullptr) {
+      return;
+    }
+    try {
+      FileHeader head;
+      if (std::fread(&head, sizeof(head), 1, file) != 1 ||
+          !matches(head, kSnapshotMagic)) {
+        throw runtime_error();
+      }
+      epoch_ = head.epoch_;
+      map_.assign_sorted(Loader(file, head.count_), Loader(file, 0));
+    } catch (...) {
+      std::fclose(file);
+      throw;
+    }
+    std::fclose(file);
+  }
+
+  /*Apply one group of records read back from the log.*/
+  void replay(const char *data, size_t n) {
+    alignas(Key) unsigned char key[sizeof(Key)];
+    alignas(T) unsigned char value[sizeof(T)];
+    size_t at = 0;
+    while (at < n) {
+      unsigned char op = (unsigned char)data[at++];
+      if (op == kClear) {
+        map_.clear();
+        continue;
+      }
+      std::memcpy(key, data + at, sizeof(Key));
+      at += sizeof(Key);
+      if (op == kPut) {
+        std::memcpy(value, data + at, sizeof(T));
+        at += sizeof(T);
+        map_.insert_or_assign(*reinterpret_cast<const Key *>(key),
+                              *reinterpret_cast<const T *>(value));
+      } else {
+        map_.erase(*reinterpret_cast<const Key *>(key));
+      }
+    }
+  }
+
+  /*Start the log afresh, holding nothing, for the current epoch.*/
+  void resetLog() {
+    if (::ftruncate(log_, 0) != 0) {
+      throw runtime_error();
+    }
+    FileHeader head = header(kLogMagic, 0);
+    writeAll(log_, reinterpret_cast<const char *>(&head), sizeof(head));
+    if (::fdatasync(log_) != 0) {
+      throw runtime_error();
+    }
+  }
+
+  /*Replay the whole groups of the log, cut off whatever follows them, and
+  leave the log open for appending.*/
+  void recoverLog() {
+    std::string name = path_ + ".wal";
+    log_ = ::open(name.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (log_ < 0) {
+      throw runtime_error();
+    }
+    off_t end = ::lseek(log_, 0, SEEK_END);
+    if (end < 0 || ::lseek(log_, 0, SEEK_SET) != 0) {
+      throw runtime_error();
+    }
+    FileHeader head;
+    if (readAll(log_, reinterpret_cast<char *>(&head), sizeof(head)) !=
+        sizeof(head)) {
+      /*New, or cut short while checkpoint() was starting it afresh.*/
+      resetLog();
+      return;
+    }
+    if (!matches(head, kLogMagic) || head.epoch_ > epoch_) {
+      throw runtime_error();
+    }
+    off_t whole = sizeof(head);
+    std::string data;
+    while (true) {
+      GroupHeader group;
+      if (readAll(log_, reinterpret_cast<char *>(&group), sizeof(group)) !=
+              sizeof(group) ||
+          group.bytes_ > (std::uint64_t)(end - whole)) {
+        break;
+      }
+      data.resize(group.bytes_);
+      if (readAll(log_, &data[0], group.bytes_) != group.bytes_ ||
+          checksum(data.data(), group.bytes_) != group.checksum_) {
+        break;
+      }
+      replay(data.data(), group.bytes_);
+      whole += sizeof(group) + group.bytes_;
+    }
+    if (::ftruncate(log_, whole) != 0) {
+      throw runtime_error();
+    }
+  }
+
+public:
+  /*What operator[] returns: reads as the value, and logs assignments.*/
+  class reference {
+  private:
+    friend class durable_map;
+    durable_map *it_;
+    Key key_;
+
+    reference(durable_map *it, const Key &key) : it_(it), key_(key) {}
+
+  public:
+    operator const T &() const { return it_->map_.at(key_); }
+    reference &operator=(const T &value) {
+      it_->insert_or_assign(key_, value);
+      return *this;
+    }
+    reference &operator=(const reference &other) {
+      return *this = (const T &)other;
+    }
+  };
+
+  /**
+   * open the map kept at path: load path + ".snapshot" and replay
+   * path + ".wal" on top of it, creating an empty log if there is none.
+   * Throw runtime_error if the files cannot be read or were written for a
+   * Key or T of other sizes.
+   */
+  explicit durable_map(const char *path, const Compare &comp = Compare())
+      : map_(comp), path_(path), log_(-1), epoch_(0) {
+    loadSnapshot();
+    try {
+      recoverLog();
+    } catch (...) {
+      if (log_ >= 0) {
+        ::close(log_);
+      }
+      throw;
+    }
+  }
+
+  durable_map(const durable_map &) = delete;
+  durable_map &operator=(const durable_map &) = delete;
+
+  /*Commit what is left, and close the log.*/
+  ~durable_map() {
+    try {
+      commit();
+    } catch (...) {
+    }
+    ::close(log_);
+  }
+
+  /**
+   * write the records collected so far to the log as one group and wait
+   * until they are on disk. Throw runtime_error if that fails; the records
+   * are then kept for the next try.
+   */
+  void commit() {
+    if (group_.empty()) {
+      return;
+    }
+    GroupHeader group;
+    group.bytes_ = group_.size();
+    group.checksum_ = checksum(group_.data(), group_.size());
+    std::string frame(reinterpret_cast<const char *>(&group), sizeof(group));
+    frame += group_;
+    writeAll(log_, frame.data(), frame.size());
+    if (::fdatasync(log_) != 0) {
+      throw runtime_error();
+    }
+    group_.clear();
+  }
+
+  /**
+   * write the whole map to a new snapshot in key order and empty the log,
+   * which the snapshot now covers. The new snapshot replaces the old one by
+   * a rename only once it is on disk, so a crash at any point leaves one
+   * snapshot or the other with the log that goes with it.
+   */
+  void checkpoint() {
+    commit();
+    std::string name = path_ + ".snapshot";
+    std::string temp = name + ".tmp";
+    std::FILE *file = std::fopen(temp.c_str(), "wb");
+    if (file == nullptr) {
+      throw runtime_error();
+    }
+    ++epoch_;
+    try {
+      FileHeader head = header(kSnapshotMagic, map_.size());
+      bool good = std::fwrite(&head, sizeof(head), 1, file) == 1;
+      for (const_iterator it = map_.cbegin(); good && it != map_.cend();
+           ++it) {
+        good = std::fwrite(&it->first, sizeof(Key), 1, file) == 1 &&
+               std::fwrite(&it->second, sizeof(T), 1, file) == 1;
+      }
+      if (!good || std::fflush(file) != 0 || ::fsync(fileno(file)) != 0) {
+        throw runtime_error();
+      }
+    } catch (...) {
+      --epoch_;
+      std::fclose(file);
+      std::remove(temp.c_str());
+      throw;
+    }
+    if (std::fclose(file) != 0 ||
+        std::rename(temp.c_str(), name.c_str()) != 0) {
+      --epoch_;
+      std::remove(temp.c_str());
+      throw runtime_error();
+    }
+    syncDirectoryOf(name);
+    resetLog();
+  }
+
+  /*Everything to read the map with; changes go through durable_map.*/
+  const map_type &contents() const { return map_; }
+
+  size_t size() const { return map_.size(); }
+  bool empty() const { return map_.empty(); }
+  size_t count(const Key &key) const { return map_.count(key); }
+  const_iterator find(const Key &key) const { return map_.find(key); }
+  const T &at(const Key &key) const { return map_.at(key); }
+
+  /*The value with key, inserted value-initialised (and logged) if missing;
+  assigning to it is logged as well.*/
+  reference operator[](const Key &key) {
+    if (map_.count(key) == 0) {
+      insert(value_type(key, T()));
+    }
+    return reference(this, key);
+  }
+
+  /**
+   * insert an element.
+   * return a pair, the first of the pair is
+   *   the iterator to the new element (or the element that prevented the
+   * insertion), the second one is true if insert successfully, or false.
+   * Only an insertion is logged.
+   */
+  pair<const_iterator, bool> insert(const value_type &value) {
+    pair<typename map_type::iterator, bool> result = map_.insert(value);
+    if (result.second) {
+      append(kPut, &value.first, &value.second);
+    }
+    return pair<const_iterator, bool>(result.first, result.second);
+  }
+
+  /*Set the value of key to obj, inserting it if missing; return whether it
+  was inserted.*/
+  bool insert_or_assign(const Key &key, const T &obj) {
+    bool inserted = map_.insert_or_assign(key, obj).second;
+    append(kPut, &key, &obj);
+    return inserted;
+  }
+
+  /*Erase the element with key, if any, and return how many were erased.
+  Only an erasure is logged.*/
+  size_t erase(const Key &key) {
+    size_t erased = map_.erase(key);
+    if (erased != 0) {
+      append(kErase, &key, nullptr);
+    }
+    return erased;
+  }
+
+  void clear() {
+    map_.clear();
+    append(kClear, nullptr, nullptr);
+  }
+};
+
+} // namespace sjtu
+
+#endif
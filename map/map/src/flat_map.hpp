@@ -0,0 +1,611 @@
+/**
+ * an ordered map kept in sorted arrays
+ */
+#ifndef SJTU_FLAT_MAP_HPP
+#define SJTU_FLAT_MAP_HPP
+
+#include "exceptions.hpp"
+#include "map.hpp"
+#include "utility.hpp"
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <utility>
+
+#if defined(__GNUC__)
+#define SJTU_FLAT_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define SJTU_FLAT_PREFETCH(address) ((void)0)
+#endif
+
+namespace sjtu {
+
+/*
+  An ordered map for tables that are built once and then mostly read. The
+keys are kept sorted in one contiguous array and the values, in the same
+order, in another, as std::flat_map does: a lookup is a binary search over
+nothing but keys, O(log n) comparisons on cache lines full of them, and the
+map takes no memory beyond its elements, where map spends three pointers and
+a word per node.
+  The binary search is branchless: it halves the range by adding the
+comparison times the half rather than by a jump (which is what a ?: turns
+into), so there is no branch to mispredict. Having no branch to speculate on,
+the CPU would not start on the next probe before the comparison is in, so the
+search prefetches both places the next probe can be [Khuong & Morin 2017].
+  Inserting or erasing one element moves everything after it, O(n). Many
+elements should come in through insert_range(), which appends them all and
+then sorts and merges once, in O(n + m log m).
+  Elements are moved around by move construction, never by assignment, so
+Key need not be assignable, but Key and T must not throw when moved. As the
+elements are split in two arrays, iterators yield a pair of references,
+pair<const Key &, T &>, rather than a reference to a pair; it->first and
+it->second work as for map. Any insertion or erasure invalidates all
+iterators.
+*/
+template <class Key, class T, class Compare = std::less<Key>>
+class flat_map : private map_compare_holder<Compare> {
+public:
+  typedef pair<const Key, T> value_type;
+  typedef pair<const Key &, T &> reference;
+  typedef pair<const Key &, const T &> const_reference;
+
+  class const_iterator;
+  class iterator;
+
+private:
+  using map_compare_holder<Compare>::comp;
+
+  /*
+    One column of the map: a growable array in raw storage like
+  sjtu::vector, but moving its elements by construction and destruction, and
+  with unchecked access for the search loop.
+  */
+  template <class U> class Column {
+  private:
+    U *data_;
+    size_t size_;
+    size_t capacity_;
+
+  public:
+    Column() : data_(nullptr), size_(0), capacity_(0) {}
+    Column(const Column &other) : data_(nullptr), size_(0), capacity_(0) {
+      reserve(other.size_);
+      try {
+        for (; size_ < other.size_; ++size_) {
+          new (data_ + size_) U(other.data_[size_]);
+        }
+      } catch (...) {
+        clear();
+        ::operator delete(data_);
+        throw;
+      }
+    }
+    Column &operator=(const Column &) = delete;
+    ~Column() {
+      clear();
+      ::operator delete(data_);
+    }
+
+    void swap(Column &other) {
+      std::swap(data_, other.data_);
+      std::swap(size_, other.size_);
+      std::swap(capacity_, other.capacity_);
+    }
+
+    U *data() const { return data_; }
+    size_t size() const { return size_; }
+    U &operator[](size_t pos) const { return data_[pos]; }
+
+    void reserve(size_t capacity) {
+      if (capacity <= capacity_) {
+        return;
+      }
+      U *data = static_cast<U *>(::operator new(capacity * sizeof(U)));
+      for (size_t i = 0; i < size_; ++i) {
+        new (data + i) U(std::move(data_[i]));
+        data_[i].~U();
+      }
+      ::operator delete(data_);
+      data_ = data;
+      capacity_ = capacity;
+    }
+
+    template <class V> void push_back(V &&value) {
+      if (size_ == capacity_) {
+        reserve(capacity_ == 0 ? 8 : capacity_ * 2);
+      }
+      new (data_ + size_) U(std::forward<V>(value));
+      ++size_;
+    }
+
+    /*Move the elements from pos up one place and build the new one at pos;
+    should that throw, move them back.*/
+    template <class V> void insert(size_t pos, V &&value) {
+      if (size_ == capacity_) {
+        reserve(capacity_ == 0 ? 8 : capacity_ * 2);
+      }
+      for (size_t i = size_; i > pos; --i) {
+        new (data_ + i) U(std::move(data_[i - 1]));
+        data_[i - 1].~U();
+      }
+      try {
+        new (data_ + pos) U(std::forward<V>(value));
+      } catch (...) {
+        for (size_t i = pos; i < size_; ++i) {
+          new (data_ + i) U(std::move(data_[i + 1]));
+          data_[i + 1].~U();
+        }
+        throw;
+      }
+      ++size_;
+    }
+
+    void erase(size_t pos) {
+      data_[pos].~U();
+      for (size_t i = pos + 1; i < size_; ++i) {
+        new (data_ + i - 1) U(std::move(data_[i]));
+        data_[i].~U();
+      }
+      --size_;
+    }
+
+    /*Destroy the elements from size on.*/
+    void truncate(size_t size) {
+      while (size_ > size) {
+        data_[--size_].~U();
+      }
+    }
+
+    void clear() { truncate(0); }
+  };
+
+  Column<Key> keys_;
+  Column<T> values_;
+
+  /*The first position whose key is not less than key, or greater than key
+  for upper.*/
+  size_t boundOf(const Key &key, bool upper) const {
+    size_t n = keys_.size();
+    if (n == 0) {
+      return 0;
+    }
+    const Key *base = keys_.data();
+    if (upper) {
+      while (n > 1) {
+        size_t half = n / 2;
+        SJTU_FLAT_PREFETCH(base + (n - half) / 2);
+        SJTU_FLAT_PREFETCH(base + half + (n - half) / 2);
+        base += !comp()(key, base[half - 1]) * half;
+        n -= half;
+      }
+      return base - keys_.data() + !comp()(key, *base);
+    }
+    while (n > 1) {
+      size_t half = n / 2;
+      SJTU_FLAT_PREFETCH(base + (n - half) / 2);
+      SJTU_FLAT_PREFETCH(base + half + (n - half) / 2);
+      base += comp()(base[half - 1], key) * half;
+      n -= half;
+    }
+    return base - keys_.data() + comp()(*base, key);
+  }
+
+  /*The position of key, or size() if it is missing.*/
+  size_t findPos(const Key &key) const {
+    size_t pos = boundOf(key, false);
+    if (pos == keys_.size() || comp()(key, keys_[pos])) {
+      return keys_.size();
+    }
+    return pos;
+  }
+
+  template <class K, class... Args>
+  pair<iterator, bool> tryEmplace(K &&key, Args &&...args) {
+    size_t pos = boundOf(key, false);
+    if (pos != keys_.size() && !comp()(key, keys_[pos])) {
+      return pair<iterator, bool>(iterator(this, pos), false);
+    }
+    keys_.insert(pos, std::forward<K>(key));
+    try {
+      values_.insert(pos, T(std::forward<Args>(args)...));
+    } catch (...) {
+      keys_.erase(pos);
+      throw;
+    }
+    return pair<iterator, bool>(iterator(this, pos), true);
+  }
+
+  /*Stable bottom-up merge sort of order[0, n) by keys_[base + order[i]],
+  using scratch; returns whichever of the two ends up holding the result.*/
+  const size_t *sortOrder(size_t *order, size_t *scratch, size_t n,
+                          size_t base) {
+    for (size_t width = 1; width < n; width *= 2) {
+      for (size_t lo = 0; lo < n; lo += 2 * width) {
+        size_t mid = lo + width < n ? lo + width : n;
+        size_t hi = mid + width < n ? mid + width : n;
+        size_t i = lo;
+        size_t j = mid;
+        size_t k = lo;
+        while (i < mid && j < hi) {
+          if (comp()(keys_[base + order[j]], keys_[base + order[i]])) {
+            scratch[k++] = order[j++];
+          } else {
+            scratch[k++] = order[i++];
+          }
+        }
+        while (i < mid) {
+          scratch[k++] = order[i++];
+        }
+        while (j < hi) {
+          scratch[k++] = order[j++];
+        }
+      }
+      std::swap(order, scratch);
+    }
+    return order;
+  }
+
+public:
+  class iterator {
+  private:
+    friend class flat_map;
+    const flat_map *it_;
+    size_t at_;
+
+    /*What operator-> returns: it holds the pair of references.*/
+    class Arrow {
+    private:
+      reference ref_;
+
+    public:
+      explicit Arrow(const reference &ref) : ref_(ref) {}
+      const reference *operator->() const { return &ref_; }
+    };
+
+  public:
+    iterator() : it_(nullptr), at_(0) {}
+    iterator(const flat_map *it, size_t at) : it_(it), at_(at) {}
+    iterator(const iterator &other) : it_(other.it_), at_(other.at_) {}
+
+    iterator operator++(int) {
+      iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    iterator &operator++() {
+      if (it_ == nullptr || at_ >= it_->keys_.size()) {
+        throw invalid_iterator();
+      }
+      ++at_;
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator temp(*this);
+      --*this;
+      return temp;
+    }
+    iterator &operator--() {
+      if (it_ == nullptr || at_ == 0) {
+        throw invalid_iterator();
+      }
+      --at_;
+      return *this;
+    }
+
+    reference operator*() const {
+      return reference(it_->keys_[at_], it_->values_[at_]);
+    }
+    Arrow operator->() const { return Arrow(**this); }
+
+    bool operator==(const iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator==(const const_iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  class const_iterator {
+  private:
+    friend class flat_map;
+    const flat_map *it_;
+    size_t at_;
+
+    class Arrow {
+    private:
+      const_reference ref_;
+
+    public:
+      explicit Arrow(const const_reference &ref) : ref_(ref) {}
+      const const_reference *operator->() const { return &ref_; }
+    };
+
+  public:
+    const_iterator() : it_(nullptr), at_(0) {}
+    const_iterator(const flat_map *it, size_t at) : it_(it), at_(at) {}
+    const_iterator(const const_iterator &other)
+        : it_(other.it_), at_(other.at_) {}
+    const_iterator(const iterator &other) : it_(other.it_), at_(other.at_) {}
+
+    const_iterator operator++(int) {
+      const_iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    const_iterator &operator++() {
+      if (it_ == nullptr || at_ >= it_->keys_.size()) {
+        throw invalid_iterator();
+      }
+      ++at_;
+      return *this;
+    }
+    const_iterator operator--(int) {
+      const_iterator temp(*this);
+      --*this;
+      return temp;
+    }
+    const_iterator &operator--() {
+      if (it_ == nullptr || at_ == 0) {
+        throw invalid_iterator();
+      }
+      --at_;
+      return *this;
+    }
+
+    const_reference operator*() const {
+      return const_reference(it_->keys_[at_], it_->values_[at_]);
+    }
+    Arrow operator->() const { return Arrow(**this); }
+
+    bool operator==(const iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator==(const const_iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  flat_map() {}
+  explicit flat_map(const Compare &comp) : map_compare_holder<Compare>(comp) {}
+
+  /*The elements of [first, last), put in order by insert_range().*/
+  template <class InputIterator>
+  flat_map(InputIterator first, InputIterator last,
+           const Compare &comp = Compare())
+      : map_compare_holder<Compare>(comp) {
+    insert_range(first, last);
+  }
+
+  flat_map(const flat_map &other)
+      : map_compare_holder<Compare>(other.comp()), keys_(other.keys_),
+        values_(other.values_) {}
+
+  flat_map &operator=(const flat_map &other) {
+    if (this == &other) {
+      return *this;
+    }
+    flat_map copy(other);
+    keys_.swap(copy.keys_);
+    values_.swap(copy.values_);
+    map_compare_holder<Compare>::comp() = other.comp();
+    return *this;
+  }
+
+  /**
+   * access specified element with bounds checking
+   * Returns a reference to the mapped value of the element with key
+   * equivalent to key. If no such element exists, an exception of type
+   * `index_out_of_bound' is thrown.
+   */
+  T &at(const Key &key) {
+    size_t pos = findPos(key);
+    if (pos == keys_.size()) {
+      throw index_out_of_bound();
+    }
+    return values_[pos];
+  }
+  const T &at(const Key &key) const {
+    size_t pos = findPos(key);
+    if (pos == keys_.size()) {
+      throw index_out_of_bound();
+    }
+    return values_[pos];
+  }
+
+  /**
+   * access specified element
+   * Returns a reference to the value that is mapped to a key equivalent to
+   * key, performing an insertion if such key does not already exist.
+   */
+  T &operator[](const Key &key) { return values_[tryEmplace(key).first.at_]; }
+  T &operator[](Key &&key) {
+    return values_[tryEmplace(std::move(key)).first.at_];
+  }
+  /*behave like at() throw index_out_of_bound if such key does not exist.*/
+  const T &operator[](const Key &key) const { return at(key); }
+
+  iterator begin() { return iterator(this, 0); }
+  const_iterator cbegin() const { return const_iterator(this, 0); }
+  iterator end() { return iterator(this, keys_.size()); }
+  const_iterator cend() const { return const_iterator(this, keys_.size()); }
+
+  bool empty() const { return keys_.size() == 0; }
+
+  size_t size() const { return keys_.size(); }
+
+  void clear() {
+    keys_.clear();
+    values_.clear();
+  }
+
+  /*Make room for n elements in all.*/
+  void reserve(size_t n) {
+    keys_.reserve(n);
+    values_.reserve(n);
+  }
+
+  /**
+   * insert an element.
+   * return a pair, the first of the pair is
+   *   the iterator to the new element (or the element that prevented the
+   * insertion), the second one is true if insert successfully, or false.
+   */
+  pair<iterator, bool> insert(const value_type &value) {
+    return tryEmplace(value.first, value.second);
+  }
+
+  /**
+   * insert the elements of [first, last) whose keys are not in the map yet;
+   * of several with the same key, the first is taken. Each *first needs
+   * .first and .second, as a value_type has.
+   *
+   * The elements are appended as they come, then the appended run is sorted
+   * and merged with the rest in one pass: O(n + m log m) for m new elements,
+   * and O(m) when they come sorted and after all the keys already there.
+   * Should building an element throw, the map is left as it was.
+   */
+  template <class InputIterator>
+  void insert_range(InputIterator first, InputIterator last) {
+    size_t old_size = keys_.size();
+    try {
+      for (; first != last; ++first) {
+        keys_.push_back((*first).first);
+        values_.push_back((*first).second);
+      }
+    } catch (...) {
+      keys_.truncate(old_size);
+      values_.truncate(old_size);
+      throw;
+    }
+    size_t n = keys_.size() - old_size;
+    if (n == 0) {
+      return;
+    }
+    /*Already in order, as when a table is built from sorted input: then
+    there is nothing to merge.*/
+    bool sorted = old_size == 0 || comp()(keys_[old_size - 1], keys_[old_size]);
+    for (size_t i = old_size + 1; sorted && i < keys_.size(); ++i) {
+      sorted = comp()(keys_[i - 1], keys_[i]);
+    }
+    if (sorted) {
+      return;
+    }
+    Column<size_t> order;
+    Column<size_t> scratch;
+    order.reserve(n);
+    scratch.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      order.push_back(i);
+      scratch.push_back(0);
+    }
+    const size_t *sorted_order =
+        sortOrder(order.data(), scratch.data(), n, old_size);
+
+    Column<Key> keys;
+    Column<T> values;
+    keys.reserve(keys_.size());
+    values.reserve(keys_.size());
+    size_t i = 0;
+    size_t j = 0;
+    while (i < old_size || j < n) {
+      size_t from;
+      if (j == n ||
+          (i < old_size &&
+           !comp()(keys_[old_size + sorted_order[j]], keys_[i]))) {
+        from = i++;
+      } else {
+        from = old_size + sorted_order[j++];
+      }
+      if (keys.size() != 0 && !comp()(keys[keys.size() - 1], keys_[from])) {
+        continue;
+      }
+      keys.push_back(std::move(keys_[from]));
+      values.push_back(std::move(values_[from]));
+    }
+    keys_.swap(keys);
+    values_.swap(values);
+  }
+
+  /*Build the value from args only if key is missing.*/
+  template <class... Args>
+  pair<iterator, bool> try_emplace(const Key &key, Args &&...args) {
+    return tryEmplace(key, std::forward<Args>(args)...);
+  }
+
+  /**
+   * erase the element at pos.
+   *
+   * throw if pos pointed to a bad element (pos == this->end() || pos points
+   * an element out of this)
+   */
+  void erase(iterator pos) {
+    if (pos.it_ != this || pos.at_ >= keys_.size()) {
+      throw invalid_iterator();
+    }
+    keys_.erase(pos.at_);
+    values_.erase(pos.at_);
+  }
+
+  /**
+   * erase the element with key, if there is one, and return the number of
+   * elements erased (0 or 1).
+   */
+  size_t erase(const Key &key) {
+    size_t pos = findPos(key);
+    if (pos == keys_.size()) {
+      return 0;
+    }
+    keys_.erase(pos);
+    values_.erase(pos);
+    return 1;
+  }
+
+  /**
+   * Returns the number of elements with key
+   *   that compares equivalent to the specified argument,
+   *   which is either 1 or 0
+   *     since this container does not allow duplicates.
+   */
+  size_t count(const Key &key) const { return findPos(key) != keys_.size(); }
+
+  /**
+   * Finds an element with key equivalent to key.
+   * key value of the element to search for.
+   * Iterator to an element with key equivalent to key.
+   *   If no such element is found, past-the-end (see end()) iterator is
+   * returned.
+   */
+  iterator find(const Key &key) { return iterator(this, findPos(key)); }
+  const_iterator find(const Key &key) const {
+    return const_iterator(this, findPos(key));
+  }
+
+  /*The first element not less than key, or greater than key for
+  upper_bound().*/
+  iterator lower_bound(const Key &key) {
+    return iterator(this, boundOf(key, false));
+  }
+  const_iterator lower_bound(const Key &key) const {
+    return const_iterator(this, boundOf(key, false));
+  }
+  iterator upper_bound(const Key &key) {
+    return iterator(this, boundOf(key, true));
+  }
+  const_iterator upper_bound(const Key &key) const {
+    return const_iterator(this, boundOf(key, true));
+  }
+};
+
+} // namespace sjtu
+
+#undef SJTU_FLAT_PREFETCH
+
+#endif
@@ -0,0 +1,353 @@
+/**
+ * a read-only map laid out for fast searching
+ */
+#ifndef SJTU_FROZEN_MAP_HPP
+#define SJTU_FROZEN_MAP_HPP
+
+#include "exceptions.hpp"
+#include "map.hpp"
+#include "utility.hpp"
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <utility>
+
+#if defined(__GNUC__)
+#define SJTU_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define SJTU_PREFETCH(address) ((void)0)
+#endif
+
+namespace sjtu {
+
+/*
+  A snapshot of a map that is never changed again, kept in the order that
+makes searching it fastest. The keys sit in one array in Eytzinger (BFS)
+order [Khuong & Morin 2017]: the root at 1 and the children of k at 2k and
+2k + 1, so the top levels of the implicit search tree share a few hot cache
+lines, and the 2^d descendants d levels below k are the contiguous run from
+2^d k. The search is branch free, k = 2k + (keys_[k] < key) until k falls off
+the tree, and before each step it prefetches the run kPrefetchLevels below,
+which is one cache line: the loads of four levels are in flight at once.
+  find_batch() goes further and runs kBatch independent searches in lock
+step, level by level, so that their cache misses overlap as well.
+  Values are kept in a second array in the same order. Iterators walk the
+keys in order through the implicit tree and yield pair<const Key &, const T &>
+(see flat_map).
+*/
+template <class Key, class T, class Compare = std::less<Key>>
+class frozen_map : private map_compare_holder<Compare> {
+public:
+  typedef pair<const Key, T> value_type;
+  typedef pair<const Key &, const T &> const_reference;
+
+  class const_iterator;
+
+private:
+  using map_compare_holder<Compare>::comp;
+
+  static const size_t kCacheLine = 64;
+  static const size_t kBatch = 16;
+
+  /*How far below a node one cache line of its descendants lies.*/
+  static const int kPrefetchLevels = sizeof(Key) <= 4    ? 4
+                                     : sizeof(Key) <= 8  ? 3
+                                     : sizeof(Key) <= 16 ? 2
+                                                         : 1;
+
+  /*1-based: keys_[0] and values_[0] are never built.*/
+  Key *keys_;
+  T *values_;
+  size_t size_;
+
+  /*Where a search that ran off the tree at k lands: undo the right turns
+  after the last left one, and that one too. 0 means past the end.*/
+  static size_t landing(size_t k) {
+#if defined(__GNUC__)
+    return k >> (__builtin_ctzll(~(unsigned long long)k) + 1);
+#else
+    while (k & 1) {
+      k >>= 1;
+    }
+    return k >> 1;
+#endif
+  }
+
+  /*The in-order successor of k in the implicit tree, 0 after the last.*/
+  size_t successor(size_t k) const {
+    if (2 * k + 1 <= size_) {
+      k = 2 * k + 1;
+      while (2 * k <= size_) {
+        k = 2 * k;
+      }
+      return k;
+    }
+    return landing(k);
+  }
+
+  /*The in-order predecessor of k, or of the end for k = 0; 0 before the
+  first.*/
+  size_t predecessor(size_t k) const {
+    if (k == 0) {
+      k = size_ == 0 ? 0 : 1;
+      while (k != 0 && 2 * k + 1 <= size_) {
+        k = 2 * k + 1;
+      }
+      return k;
+    }
+    if (2 * k <= size_) {
+      k = 2 * k;
+      while (2 * k + 1 <= size_) {
+        k = 2 * k + 1;
+      }
+      return k;
+    }
+    while (k != 0 && (k & 1) == 0) {
+      k >>= 1;
+    }
+    return k >> 1;
+  }
+
+  size_t first() const {
+    size_t k = size_ == 0 ? 0 : 1;
+    while (k != 0 && 2 * k <= size_) {
+      k = 2 * k;
+    }
+    return k;
+  }
+
+  /*The first key not less than key, or greater than key for upper.*/
+  size_t boundOf(const Key &key, bool upper) const {
+    size_t k = 1;
+    while (k <= size_) {
+      SJTU_PREFETCH(keys_ + (k << kPrefetchLevels));
+      bool right = upper ? !comp()(key, keys_[k]) : comp()(keys_[k], key);
+      k = 2 * k + right;
+    }
+    return landing(k);
+  }
+
+  size_t findIndex(const Key &key) const {
+    size_t k = boundOf(key, false);
+    if (k == 0 || comp()(key, keys_[k])) {
+      return 0;
+    }
+    return k;
+  }
+
+  void release() {
+    size_t built = size_;
+    for (size_t k = first(); built != 0; k = successor(k), --built) {
+      keys_[k].~Key();
+      values_[k].~T();
+    }
+    ::operator delete(keys_, std::align_val_t(kCacheLine));
+    ::operator delete(values_);
+  }
+
+  /*Fill both arrays in key order from [first, last), which holds n
+  elements in strictly increasing order.*/
+  template <class InputIterator>
+  void build(InputIterator first_it, InputIterator last_it, size_t n) {
+    keys_ = static_cast<Key *>(
+        ::operator new((n + 1) * sizeof(Key), std::align_val_t(kCacheLine)));
+    try {
+      values_ = static_cast<T *>(::operator new((n + 1) * sizeof(T)));
+    } catch (...) {
+      ::operator delete(keys_, std::align_val_t(kCacheLine));
+      throw;
+    }
+    size_ = n;
+    size_t built = 0;
+    size_t k = first();
+    try {
+      for (; first_it != last_it; ++first_it, k = successor(k)) {
+        new (keys_ + k) Key((*first_it).first);
+        try {
+          new (values_ + k) T((*first_it).second);
+        } catch (...) {
+          keys_[k].~Key();
+          throw;
+        }
+        ++built;
+      }
+    } catch (...) {
+      size_ = built;
+      release();
+      throw;
+    }
+  }
+
+public:
+  class const_iterator {
+  private:
+    friend class frozen_map;
+    const frozen_map *it_;
+    size_t at_;
+
+    class Arrow {
+    private:
+      const_reference ref_;
+
+    public:
+      explicit Arrow(const const_reference &ref) : ref_(ref) {}
+      const const_reference *operator->() const { return &ref_; }
+    };
+
+  public:
+    const_iterator() : it_(nullptr), at_(0) {}
+    const_iterator(const frozen_map *it, size_t at) : it_(it), at_(at) {}
+    const_iterator(const const_iterator &other)
+        : it_(other.it_), at_(other.at_) {}
+
+    const_iterator operator++(int) {
+      const_iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    const_iterator &operator++() {
+      if (it_ == nullptr || at_ == 0) {
+        throw invalid_iterator();
+      }
+      at_ = it_->successor(at_);
+      return *this;
+    }
+    const_iterator operator--(int) {
+      const_iterator temp(*this);
+      --*this;
+      return temp;
+    }
+    const_iterator &operator--() {
+      if (it_ == nullptr) {
+        throw invalid_iterator();
+      }
+      size_t k = it_->predecessor(at_);
+      if (k == 0) {
+        throw invalid_iterator();
+      }
+      at_ = k;
+      return *this;
+    }
+
+    const_reference operator*() const {
+      return const_reference(it_->keys_[at_], it_->values_[at_]);
+    }
+    Arrow operator->() const { return Arrow(**this); }
+
+    bool operator==(const const_iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  /*The elements of source as they are now; O(n).*/
+  template <class Policy>
+  explicit frozen_map(const map<Key, T, Compare, Policy> &source)
+      : map_compare_holder<Compare>(source.key_comp()) {
+    build(source.cbegin(), source.cend(), source.size());
+  }
+
+  frozen_map(const frozen_map &other)
+      : map_compare_holder<Compare>(other.comp()) {
+    build(other.cbegin(), other.cend(), other.size_);
+  }
+
+  frozen_map &operator=(const frozen_map &other) {
+    if (this == &other) {
+      return *this;
+    }
+    frozen_map copy(other);
+    std::swap(keys_, copy.keys_);
+    std::swap(values_, copy.values_);
+    std::swap(size_, copy.size_);
+    map_compare_holder<Compare>::comp() = other.comp();
+    return *this;
+  }
+
+  ~frozen_map() { release(); }
+
+  /*The value with key; throw index_out_of_bound if there is none.*/
+  const T &at(const Key &key) const {
+    size_t k = findIndex(key);
+    if (k == 0) {
+      throw index_out_of_bound();
+    }
+    return values_[k];
+  }
+  const T &operator[](const Key &key) const { return at(key); }
+
+  const_iterator begin() const { return cbegin(); }
+  const_iterator cbegin() const { return const_iterator(this, first()); }
+  const_iterator end() const { return cend(); }
+  const_iterator cend() const { return const_iterator(this, 0); }
+
+  bool empty() const { return size_ == 0; }
+
+  size_t size() const { return size_; }
+
+  size_t count(const Key &key) const { return findIndex(key) != 0; }
+
+  const_iterator find(const Key &key) const {
+    return const_iterator(this, findIndex(key));
+  }
+
+  /*The first element not less than key, or greater than key for
+  upper_bound().*/
+  const_iterator lower_bound(const Key &key) const {
+    return const_iterator(this, boundOf(key, false));
+  }
+  const_iterator upper_bound(const Key &key) const {
+    return const_iterator(this, boundOf(key, true));
+  }
+
+  /**
+   * look up keys[0, n) and set out[i] to the value of keys[i], or to nullptr
+   * if it is missing.
+   *
+   * The searches run kBatch at a time, a level of each in turn. A search
+   * that has already left the tree stays where it is and compares against
+   * the root, so all of them take the same, branch free, steps.
+   */
+  void find_batch(const Key *keys, size_t n, const T **out) const {
+    if (size_ == 0) {
+      for (size_t i = 0; i < n; ++i) {
+        out[i] = nullptr;
+      }
+      return;
+    }
+    int height = 0;
+    for (size_t m = size_; m != 0; m >>= 1) {
+      ++height;
+    }
+    size_t at[kBatch];
+    for (size_t start = 0; start < n; start += kBatch) {
+      size_t batch = n - start < kBatch ? n - start : kBatch;
+      const Key *group = keys + start;
+      for (size_t j = 0; j < batch; ++j) {
+        at[j] = 1;
+      }
+      for (int level = 0; level < height; ++level) {
+        for (size_t j = 0; j < batch; ++j) {
+          size_t k = at[j];
+          bool inside = k <= size_;
+          SJTU_PREFETCH(keys_ + (k << kPrefetchLevels));
+          bool right = comp()(keys_[inside ? k : 1], group[j]);
+          at[j] = inside ? 2 * k + right : k;
+        }
+      }
+      for (size_t j = 0; j < batch; ++j) {
+        size_t k = landing(at[j]);
+        out[start + j] =
+            k == 0 || comp()(group[j], keys_[k]) ? nullptr : values_ + k;
+      }
+    }
+  }
+};
+
+} // namespace sjtu
+
+#undef SJTU_PREFETCH
+
+#endif
@@ -0,0 +1,579 @@
+/**
+ * an ordered map whose copies are O(1) snapshots
+ */
+#ifndef SJTU_PERSISTENT_MAP_HPP
+#define SJTU_PERSISTENT_MAP_HPP
+
+#include "exceptions.hpp"
+#include "map.hpp"
+#include "utility.hpp"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+namespace sjtu {
+
+/*
+  An ordered map whose versions share structure. Copying one, or calling
+snapshot(), is O(1): the two simply point at the same root. A change never
+touches a node that another version can see. It copies the nodes on its way
+down from the root instead (path copying), O(log n) of them, and shares all
+the rest. Every node counts the parents and roots pointing at it and goes away
+with the last of them, so a snapshot holds on to memory in proportion to the
+changes made since it was taken, not to the size of the map.
+  A node that only one version can reach, which is every node of a map with
+no live snapshot, is changed in place: a map nobody snapshots pays for being
+persistent with the reference counts only.
+  The tree is a left-leaning red-black tree [Sedgewick 2008]. Path copying
+rules out parent pointers, since a shared node has a parent in every version,
+and without them LLRB insertion and erasure are short recursions that
+rebalance on the way back up.
+  Different versions may be used from different threads at once, as long as
+each persistent_map object is used by one thread at a time: shared nodes are
+never written, and the counts are atomic. Iterators carry the path to their
+node, so any change to a map invalidates its iterators, but not those of its
+snapshots.
+*/
+template <class Key, class T, class Compare = std::less<Key>>
+class persistent_map : private map_compare_holder<Compare> {
+public:
+  typedef pair<const Key, T> value_type;
+
+  class const_iterator;
+
+private:
+  using map_compare_holder<Compare>::comp;
+
+  /*Deeper than any red-black tree that fits in memory.*/
+  static const int kMaxDepth = 128;
+
+  class Node {
+  private:
+    std::atomic<int> refs_;
+    bool red_;
+    Node *left_;
+    Node *right_;
+    value_type value_;
+
+  public:
+    Node(const value_type &value)
+        : refs_(1), red_(true), left_(nullptr), right_(nullptr),
+          value_(value) {}
+
+    /*A private copy of a shared node, sharing its children in turn.*/
+    Node(const Node &other)
+        : refs_(1), red_(other.red_), left_(other.left_),
+          right_(other.right_), value_(other.value_) {
+      retain(left_);
+      retain(right_);
+    }
+
+    friend class persistent_map;
+  };
+
+  Node *root_;
+  size_t size_;
+
+  static void retain(Node *node) {
+    if (node != nullptr) {
+      node->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  static void release(Node *node) {
+    if (node != nullptr &&
+        node->refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      release(node->left_);
+      release(node->right_);
+      delete node;
+    }
+  }
+
+  /*
+    Make the node at link one that no other version can reach, copying it if
+  it is shared. Called on the way down from the root only, so a count of 1
+  really means that the node hangs off this version alone. The link is
+  updated before anything else may throw, which keeps the tree whole.
+  */
+  static Node *own(Node *&link) {
+    Node *node = link;
+    if (node == nullptr ||
+        node->refs_.load(std::memory_order_acquire) == 1) {
+      return node;
+    }
+    link = new Node(*node);
+    release(node);
+    return link;
+  }
+
+  static bool isRed(const Node *node) {
+    return node != nullptr && node->red_;
+  }
+
+  /*The rotations and flips of an LLRB tree, on owned nodes only.*/
+  static void rotateLeft(Node *&link) {
+    Node *node = link;
+    Node *right = own(node->right_);
+    node->right_ = right->left_;
+    right->left_ = node;
+    right->red_ = node->red_;
+    node->red_ = true;
+    link = right;
+  }
+
+  static void rotateRight(Node *&link) {
+    Node *node = link;
+    Node *left = own(node->left_);
+    node->left_ = left->right_;
+    left->right_ = node;
+    left->red_ = node->red_;
+    node->red_ = true;
+    link = left;
+  }
+
+  static void flipColors(Node *node) {
+    own(node->left_);
+    own(node->right_);
+    node->red_ = !node->red_;
+    node->left_->red_ = !node->left_->red_;
+    node->right_->red_ = !node->right_->red_;
+  }
+
+  static void balance(Node *&link) {
+    if (isRed(link->right_) && !isRed(link->left_)) {
+      rotateLeft(link);
+    }
+    if (isRed(link->left_) && isRed(link->left_->left_)) {
+      rotateRight(link);
+    }
+    if (isRed(link->left_) && isRed(link->right_)) {
+      flipColors(link);
+    }
+  }
+
+  static void moveRedLeft(Node *&link) {
+    flipColors(link);
+    if (isRed(link->right_->left_)) {
+      rotateRight(link->right_);
+      rotateLeft(link);
+      flipColors(link);
+    }
+  }
+
+  static void moveRedRight(Node *&link) {
+    flipColors(link);
+    if (isRed(link->left_->left_)) {
+      rotateRight(link);
+      flipColors(link);
+    }
+  }
+
+  /*Insert value below link, unless its key is there already. The path down
+  to that key is owned either way.*/
+  bool insertBelow(Node *&link, const value_type &value) {
+    if (link == nullptr) {
+      link = new Node(value);
+      return true;
+    }
+    Node *node = own(link);
+    bool inserted;
+    if (comp()(value.first, node->value_.first)) {
+      inserted = insertBelow(node->left_, value);
+    } else if (comp()(node->value_.first, value.first)) {
+      inserted = insertBelow(node->right_, value);
+    } else {
+      return false;
+    }
+    if (inserted) {
+      balance(link);
+    }
+    return inserted;
+  }
+
+  /*Detach the least node below link, owned, into least.*/
+  static void removeMin(Node *&link, Node *&least) {
+    Node *node = own(link);
+    if (node->left_ == nullptr) {
+      least = node;
+      link = nullptr;
+      return;
+    }
+    if (!isRed(node->left_) && !isRed(node->left_->left_)) {
+      moveRedLeft(link);
+    }
+    removeMin(link->left_, least);
+    balance(link);
+  }
+
+  /*Erase the node with key, which is known to be present, below link.*/
+  void eraseBelow(Node *&link, const Key &key) {
+    own(link);
+    if (comp()(key, link->value_.first)) {
+      if (!isRed(link->left_) && !isRed(link->left_->left_)) {
+        moveRedLeft(link);
+      }
+      eraseBelow(link->left_, key);
+    } else {
+      if (isRed(link->left_)) {
+        rotateRight(link);
+      }
+      if (!comp()(link->value_.first, key) && link->right_ == nullptr) {
+        release(link);
+        link = nullptr;
+        return;
+      }
+      if (!isRed(link->right_) && !isRed(link->right_->left_)) {
+        moveRedRight(link);
+      }
+      if (!comp()(link->value_.first, key)) {
+        /*The keys are const, so the successor node takes the place of the
+        erased one instead of lending it its value.*/
+        Node *least;
+        removeMin(link->right_, least);
+        Node *node = link;
+        least->left_ = node->left_;
+        least->right_ = node->right_;
+        least->red_ = node->red_;
+        node->left_ = node->right_ = nullptr;
+        release(node);
+        link = least;
+      } else {
+        eraseBelow(link->right_, key);
+      }
+    }
+    balance(link);
+  }
+
+  Node *findNode(const Key &key) const {
+    Node *node = root_;
+    while (node != nullptr) {
+      if (comp()(key, node->value_.first)) {
+        node = node->left_;
+      } else if (comp()(node->value_.first, key)) {
+        node = node->right_;
+      } else {
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+  /*The node with key, if any, after making the whole path to it private to
+  this version so that its value may be written.*/
+  Node *ownPath(const Key &key) {
+    Node **link = &root_;
+    while (*link != nullptr) {
+      Node *node = own(*link);
+      if (comp()(key, node->value_.first)) {
+        link = &node->left_;
+      } else if (comp()(node->value_.first, key)) {
+        link = &node->right_;
+      } else {
+        return node;
+      }
+    }
+    return nullptr;
+  }
+
+public:
+  /*
+    An iterator of one version. It keeps the path from the root down to its
+  node, so ++ and -- need no parent pointers; the end iterator has an empty
+  path.
+  */
+  class const_iterator {
+  private:
+    friend class persistent_map;
+    const Node *root_;
+    const Node *path_[kMaxDepth];
+    int depth_;
+
+    void pushLeftmost(const Node *node) {
+      for (; node != nullptr; node = node->left_) {
+        path_[depth_++] = node;
+      }
+    }
+    void pushRightmost(const Node *node) {
+      for (; node != nullptr; node = node->right_) {
+        path_[depth_++] = node;
+      }
+    }
+
+  public:
+    const_iterator() : root_(nullptr), depth_(0) {}
+    explicit const_iterator(const Node *root) : root_(root), depth_(0) {}
+    const_iterator(const const_iterator &other)
+        : root_(other.root_), depth_(other.depth_) {
+      for (int i = 0; i < depth_; ++i) {
+        path_[i] = other.path_[i];
+      }
+    }
+    const_iterator &operator=(const const_iterator &other) {
+      root_ = other.root_;
+      depth_ = other.depth_;
+      for (int i = 0; i < depth_; ++i) {
+        path_[i] = other.path_[i];
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      const_iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    const_iterator &operator++() {
+      if (depth_ == 0) {
+        throw invalid_iterator();
+      }
+      const Node *node = path_[depth_ - 1];
+      if (node->right_ != nullptr) {
+        pushLeftmost(node->right_);
+        return *this;
+      }
+      const Node *child;
+      do {
+        child = path_[--depth_];
+      } while (depth_ != 0 && path_[depth_ - 1]->right_ == child);
+      return *this;
+    }
+    const_iterator operator--(int) {
+      const_iterator temp(*this);
+      --*this;
+      return temp;
+    }
+    const_iterator &operator--() {
+      if (depth_ == 0) {
+        if (root_ == nullptr) {
+          throw invalid_iterator();
+        }
+        pushRightmost(root_);
+        return *this;
+      }
+      const Node *node = path_[depth_ - 1];
+      if (node->left_ != nullptr) {
+        pushRightmost(node->left_);
+        return *this;
+      }
+      int depth = depth_;
+      const Node *child;
+      do {
+        child = path_[--depth];
+      } while (depth != 0 && path_[depth - 1]->left_ == child);
+      if (depth == 0) {
+        throw invalid_iterator();
+      }
+      depth_ = depth;
+      return *this;
+    }
+
+    const value_type &operator*() const {
+      return path_[depth_ - 1]->value_;
+    }
+    const value_type *operator->() const noexcept {
+      return &path_[depth_ - 1]->value_;
+    }
+
+    bool operator==(const const_iterator &rhs) const {
+      if (depth_ == 0 || rhs.depth_ == 0) {
+        return depth_ == rhs.depth_ && root_ == rhs.root_;
+      }
+      return path_[depth_ - 1] == rhs.path_[rhs.depth_ - 1];
+    }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  persistent_map() : root_(nullptr), size_(0) {}
+  explicit persistent_map(const Compare &comp)
+      : map_compare_holder<Compare>(comp), root_(nullptr), size_(0) {}
+
+  /*O(1): the copy shares every node with other.*/
+  persistent_map(const persistent_map &other)
+      : map_compare_holder<Compare>(other.comp()), root_(other.root_),
+        size_(other.size_) {
+    retain(root_);
+  }
+
+  persistent_map &operator=(const persistent_map &other) {
+    if (this == &other) {
+      return *this;
+    }
+    retain(other.root_);
+    release(root_);
+    root_ = other.root_;
+    size_ = other.size_;
+    map_compare_holder<Compare>::comp() = other.comp();
+    return *this;
+  }
+
+  ~persistent_map() { release(root_); }
+
+  /**
+   * the map as it is now, in O(1). Later changes to either one are not seen
+   * by the other.
+   */
+  persistent_map snapshot() const { return *this; }
+
+  /**
+   * access the value with key, throw index_out_of_bound if there is none.
+   * The non-const version copies the shared nodes on the path to the element
+   * first, so that writing to it does not show in any snapshot.
+   */
+  const T &at(const Key &key) const {
+    Node *node = findNode(key);
+    if (node == nullptr) {
+      throw index_out_of_bound();
+    }
+    return node->value_.second;
+  }
+  T &at(const Key &key) {
+    if (findNode(key) == nullptr) {
+      throw index_out_of_bound();
+    }
+    return ownPath(key)->value_.second;
+  }
+
+  /*Inserts T() if key is missing; the reference is private like at()'s.*/
+  T &operator[](const Key &key) {
+    Node *node = ownPath(key);
+    if (node == nullptr) {
+      insert(value_type(key, T()));
+      node = ownPath(key);
+    }
+    return node->value_.second;
+  }
+  /*behave like at() throw index_out_of_bound if such key does not exist.*/
+  const T &operator[](const Key &key) const { return at(key); }
+
+  const_iterator begin() const { return cbegin(); }
+  const_iterator cbegin() const {
+    const_iterator it(root_);
+    it.pushLeftmost(root_);
+    return it;
+  }
+  const_iterator end() const { return cend(); }
+  const_iterator cend() const { return const_iterator(root_); }
+
+  bool empty() const { return size_ == 0; }
+
+  size_t size() const { return size_; }
+
+  void clear() {
+    release(root_);
+    root_ = nullptr;
+    size_ = 0;
+  }
+
+  /**
+   * insert an element.
+   * return true if it was inserted, or false if its key was already there.
+   * Copies the shared nodes on the way, O(log n) of them.
+   */
+  bool insert(const value_type &value) {
+    if (!insertBelow(root_, value)) {
+      return false;
+    }
+    root_->red_ = false;
+    ++size_;
+    return true;
+  }
+
+  /**
+   * insert (key, obj), or assign obj to the element with key.
+   * return true if it was inserted.
+   */
+  bool insert_or_assign(const Key &key, const T &obj) {
+    Node *node = ownPath(key);
+    if (node == nullptr) {
+      return insert(value_type(key, obj));
+    }
+    node->value_.second = obj;
+    return false;
+  }
+
+  /**
+   * erase the element with key, if there is one, and return the number of
+   * elements erased (0 or 1).
+   */
+  size_t erase(const Key &key) {
+    if (findNode(key) == nullptr) {
+      return 0;
+    }
+    own(root_);
+    if (!isRed(root_->left_) && !isRed(root_->right_)) {
+      root_->red_ = true;
+    }
+    eraseBelow(root_, key);
+    if (root_ != nullptr) {
+      root_->red_ = false;
+    }
+    --size_;
+    return 1;
+  }
+
+  /**
+   * Returns the number of elements with key
+   *   that compares equivalent to the specified argument,
+   *   which is either 1 or 0
+   *     since this container does not allow duplicates.
+   */
+  size_t count(const Key &key) const { return findNode(key) != nullptr; }
+
+  /**
+   * Finds an element with key equivalent to key.
+   * key value of the element to search for.
+   * Iterator to an element with key equivalent to key.
+   *   If no such element is found, past-the-end (see end()) iterator is
+   * returned.
+   */
+  const_iterator find(const Key &key) const {
+    const_iterator it(root_);
+    const Node *node = root_;
+    while (node != nullptr) {
+      it.path_[it.depth_++] = node;
+      if (comp()(key, node->value_.first)) {
+        node = node->left_;
+      } else if (comp()(node->value_.first, key)) {
+        node = node->right_;
+      } else {
+        return it;
+      }
+    }
+    return cend();
+  }
+
+  /*The first element not less than key, or greater than key for
+  upper_bound(); the path is cut back to the last node that qualified.*/
+  const_iterator lower_bound(const Key &key) const {
+    return boundOf(key, false);
+  }
+  const_iterator upper_bound(const Key &key) const {
+    return boundOf(key, true);
+  }
+
+private:
+  const_iterator boundOf(const Key &key, bool upper) const {
+    const_iterator it(root_);
+    int found = 0;
+    const Node *node = root_;
+    while (node != nullptr) {
+      it.path_[it.depth_++] = node;
+      bool right = upper ? !comp()(key, node->value_.first)
+                         : comp()(node->value_.first, key);
+      if (right) {
+        node = node->right_;
+      } else {
+        found = it.depth_;
+        node = node->left_;
+      }
+    }
+    it.depth_ = found;
+    return it;
+  }
+};
+
+} // namespace sjtu
+
+#endif
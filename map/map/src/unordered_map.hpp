@@ -0,0 +1,578 @@
+/**
+ * implement a container like std::unordered_map
+ */
+#ifndef SJTU_UNORDERED_MAP_HPP
+#define SJTU_UNORDERED_MAP_HPP
+
+#include "exceptions.hpp"
+#include "map.hpp"
+#include "utility.hpp"
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <tuple>
+#include <utility>
+
+namespace sjtu {
+
+/*
+  A hash map with open addressing: the elements sit in one array of slots,
+and a lookup reads the slots from the home of its key on, usually one or two
+of them, instead of following O(log n) pointers the way map does.
+  Collisions are resolved by linear probing with Robin Hood hashing [Celis
+1986]: an element may take the slot of one that is closer to its own home.
+Along a run of full slots the elements are then sorted by home, so a lookup
+can stop as soon as it meets an element closer to home than it would be, and
+probe sequences stay short even with the table 7/8 full. Inserting into the
+middle of a run shifts the rest of the run up one slot, and erasing shifts it
+back down (backward shift deletion), so there are no tombstones.
+  The distance of every slot from its element's home, plus one, is kept in a
+byte array apart from the slots (0 means empty): probing mostly reads just
+that. A run longer than 255 grows the table. Hashes are scrambled by Fibonacci
+hashing before being cut to the table size, since std::hash of an integer is
+the integer itself.
+  Elements move when others come and go, so any insertion or erasure
+invalidates every iterator, and Key and T must not throw when moved. Iteration
+follows the slots, in no particular order.
+*/
+template <class Key, class T, class Hash = std::hash<Key>,
+          class KeyEqual = std::equal_to<Key>>
+class unordered_map : private map_compare_holder<Hash>,
+                      private map_compare_holder<KeyEqual> {
+public:
+  typedef pair<const Key, T> value_type;
+
+  class const_iterator;
+  class iterator;
+
+private:
+  static const unsigned kMaxDist = 255;
+  static const size_t kMinCapacity = 8;
+
+  value_type *slots_;
+  unsigned char *dist_;
+  size_t capacity_;
+  size_t mask_;
+  int shift_;
+  size_t size_;
+
+  const Hash &hasher() const { return map_compare_holder<Hash>::comp(); }
+  const KeyEqual &equal() const { return map_compare_holder<KeyEqual>::comp(); }
+
+  size_t homeOf(const Key &key) const {
+    unsigned long long hash = hasher()(key);
+    return (size_t)((hash * 0x9E3779B97F4A7C15ull) >> shift_);
+  }
+
+  /*Empty slots, with a taken one past the end where iteration stops.*/
+  void allocate(size_t capacity) {
+    value_type *slots =
+        static_cast<value_type *>(::operator new(capacity * sizeof(value_type)));
+    try {
+      dist_ = new unsigned char[capacity + 1]();
+    } catch (...) {
+      ::operator delete(slots);
+      throw;
+    }
+    slots_ = slots;
+    dist_[capacity] = 1;
+    capacity_ = capacity;
+    mask_ = capacity - 1;
+    shift_ = 64;
+    for (size_t i = capacity; i > 1; i >>= 1) {
+      --shift_;
+    }
+  }
+
+  void destroyAll() {
+    for (size_t i = 0; i < capacity_; ++i) {
+      if (dist_[i] != 0) {
+        slots_[i].~value_type();
+      }
+    }
+  }
+
+  /*
+    Find key: true with pos at it, or false with pos at the slot it would
+  take, at distance dist - 1 from its home.
+  */
+  bool locate(const Key &key, size_t &pos, unsigned &dist) const {
+    pos = homeOf(key);
+    dist = 1;
+    while (dist_[pos] >= dist) {
+      if (dist_[pos] == dist && equal()(slots_[pos].first, key)) {
+        return true;
+      }
+      pos = (pos + 1) & mask_;
+      ++dist;
+    }
+    return false;
+  }
+
+  /*Whether an element can go to pos at dist without pushing any distance
+  past kMaxDist.*/
+  bool roomFor(size_t pos, unsigned dist) const {
+    if (dist > kMaxDist) {
+      return false;
+    }
+    for (; dist_[pos] != 0; pos = (pos + 1) & mask_) {
+      if (dist_[pos] == kMaxDist) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /*Shift the run from pos up one slot, leaving pos empty; return the slot
+  that was the first empty one.*/
+  size_t shiftUp(size_t pos) {
+    size_t last = pos;
+    while (dist_[last] != 0) {
+      last = (last + 1) & mask_;
+    }
+    for (size_t i = last; i != pos;) {
+      size_t prev = (i - 1) & mask_;
+      new (&slots_[i]) value_type(std::move(slots_[prev]));
+      dist_[i] = dist_[prev] + 1;
+      slots_[prev].~value_type();
+      dist_[prev] = 0;
+      i = prev;
+    }
+    return last;
+  }
+
+  /*Undo shiftUp(pos), which returned last.*/
+  void shiftDown(size_t pos, size_t last) {
+    for (size_t i = pos; i != last;) {
+      size_t next = (i + 1) & mask_;
+      new (&slots_[i]) value_type(std::move(slots_[next]));
+      dist_[i] = dist_[next] - 1;
+      slots_[next].~value_type();
+      dist_[next] = 0;
+      i = next;
+    }
+  }
+
+  /*Move into the table an element whose key is not in it.*/
+  void placeMoved(value_type &value) {
+    size_t pos;
+    unsigned dist;
+    while (true) {
+      pos = homeOf(value.first);
+      dist = 1;
+      while (dist_[pos] >= dist) {
+        pos = (pos + 1) & mask_;
+        ++dist;
+      }
+      if (roomFor(pos, dist)) {
+        break;
+      }
+      rehash(capacity_ * 2);
+    }
+    shiftUp(pos);
+    new (&slots_[pos]) value_type(std::move(value));
+    dist_[pos] = dist;
+  }
+
+  void rehash(size_t capacity) {
+    value_type *old_slots = slots_;
+    unsigned char *old_dist = dist_;
+    size_t old_capacity = capacity_;
+    allocate(capacity);
+    for (size_t i = 0; i < old_capacity; ++i) {
+      if (old_dist[i] != 0) {
+        placeMoved(old_slots[i]);
+        old_slots[i].~value_type();
+      }
+    }
+    ::operator delete(old_slots);
+    delete[] old_dist;
+  }
+
+  /*
+    Make room for key, which locate() found missing at pos and dist, and
+  find its slot again if the table had to grow. Keys so alike in hash that
+  growing does not shorten their run throw runtime_error.
+  */
+  void reserveFor(const Key &key, size_t &pos, unsigned &dist) {
+    while ((size_ + 1) * 8 > capacity_ * 7 || !roomFor(pos, dist)) {
+      if ((size_ + 1) * 8 <= capacity_ && capacity_ >= 1024) {
+        throw runtime_error();
+      }
+      rehash(capacity_ * 2);
+      locate(key, pos, dist);
+    }
+  }
+
+  /*Insert value_type(args...) unless key is there already. key must be the
+  key args make.*/
+  template <class... Args>
+  pair<iterator, bool> emplaceKey(const Key &key, Args &&...args) {
+    size_t pos;
+    unsigned dist;
+    if (locate(key, pos, dist)) {
+      return pair<iterator, bool>(iterator(this, pos), false);
+    }
+    reserveFor(key, pos, dist);
+    size_t last = shiftUp(pos);
+    try {
+      map_construct<Key, T>(&slots_[pos], std::forward<Args>(args)...);
+    } catch (...) {
+      shiftDown(pos, last);
+      throw;
+    }
+    dist_[pos] = dist;
+    ++size_;
+    return pair<iterator, bool>(iterator(this, pos), true);
+  }
+
+  template <class K, class... Args>
+  pair<iterator, bool> tryEmplace(K &&key, Args &&...args) {
+    const Key &lookup = key;
+    return emplaceKey(
+        lookup, std::piecewise_construct,
+        std::forward_as_tuple(std::forward<K>(key)),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+  }
+
+  /*Erase the element at pos and shift the rest of its run back down.*/
+  void eraseAt(size_t pos) {
+    slots_[pos].~value_type();
+    dist_[pos] = 0;
+    --size_;
+    for (size_t next = (pos + 1) & mask_; dist_[next] > 1;
+         next = (next + 1) & mask_) {
+      new (&slots_[pos]) value_type(std::move(slots_[next]));
+      dist_[pos] = dist_[next] - 1;
+      slots_[next].~value_type();
+      dist_[next] = 0;
+      pos = next;
+    }
+  }
+
+  size_t firstFrom(size_t pos) const {
+    while (dist_[pos] == 0) {
+      ++pos;
+    }
+    return pos;
+  }
+
+  /*The taken slot before pos; throw invalid_iterator if there is none.*/
+  size_t lastBefore(size_t pos) const {
+    while (pos != 0) {
+      if (dist_[--pos] != 0) {
+        return pos;
+      }
+    }
+    throw invalid_iterator();
+  }
+
+  size_t findSlot(const Key &key) const {
+    size_t pos;
+    unsigned dist;
+    return locate(key, pos, dist) ? pos : capacity_;
+  }
+
+public:
+  class iterator {
+  private:
+    friend class unordered_map;
+    const unordered_map *it_;
+    size_t at_;
+
+  public:
+    iterator() : it_(nullptr), at_(0) {}
+    iterator(const unordered_map *it, size_t at) : it_(it), at_(at) {}
+    iterator(const iterator &other) : it_(other.it_), at_(other.at_) {}
+
+    iterator operator++(int) {
+      iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    iterator &operator++() {
+      if (it_ == nullptr || at_ >= it_->capacity_) {
+        throw invalid_iterator();
+      }
+      at_ = it_->firstFrom(at_ + 1);
+      return *this;
+    }
+    iterator operator--(int) {
+      iterator temp(*this);
+      --*this;
+      return temp;
+    }
+    iterator &operator--() {
+      if (it_ == nullptr) {
+        throw invalid_iterator();
+      }
+      at_ = it_->lastBefore(at_);
+      return *this;
+    }
+
+    value_type &operator*() const { return it_->slots_[at_]; }
+    value_type *operator->() const noexcept { return &it_->slots_[at_]; }
+
+    bool operator==(const iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator==(const const_iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  class const_iterator {
+  private:
+    friend class unordered_map;
+    const unordered_map *it_;
+    size_t at_;
+
+  public:
+    const_iterator() : it_(nullptr), at_(0) {}
+    const_iterator(const unordered_map *it, size_t at) : it_(it), at_(at) {}
+    const_iterator(const const_iterator &other)
+        : it_(other.it_), at_(other.at_) {}
+    const_iterator(const iterator &other) : it_(other.it_), at_(other.at_) {}
+
+    const_iterator operator++(int) {
+      const_iterator temp(*this);
+      ++*this;
+      return temp;
+    }
+    const_iterator &operator++() {
+      if (it_ == nullptr || at_ >= it_->capacity_) {
+        throw invalid_iterator();
+      }
+      at_ = it_->firstFrom(at_ + 1);
+      return *this;
+    }
+    const_iterator operator--(int) {
+      const_iterator temp(*this);
+      --*this;
+      return temp;
+    }
+    const_iterator &operator--() {
+      if (it_ == nullptr) {
+        throw invalid_iterator();
+      }
+      at_ = it_->lastBefore(at_);
+      return *this;
+    }
+
+    const value_type &operator*() const { return it_->slots_[at_]; }
+    const value_type *operator->() const noexcept {
+      return &it_->slots_[at_];
+    }
+
+    bool operator==(const iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator==(const const_iterator &rhs) const {
+      return it_ == rhs.it_ && at_ == rhs.at_;
+    }
+    bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+    bool operator!=(const const_iterator &rhs) const {
+      return !(*this == rhs);
+    }
+  };
+
+  unordered_map() : size_(0) { allocate(kMinCapacity); }
+  explicit unordered_map(const Hash &hash, const KeyEqual &equal = KeyEqual())
+      : map_compare_holder<Hash>(hash), map_compare_holder<KeyEqual>(equal),
+        size_(0) {
+    allocate(kMinCapacity);
+  }
+
+  /*The copy has the same slots as other, so nothing is hashed again.*/
+  unordered_map(const unordered_map &other)
+      : map_compare_holder<Hash>(other.hasher()),
+        map_compare_holder<KeyEqual>(other.equal()), size_(other.size_) {
+    allocate(other.capacity_);
+    size_t i = 0;
+    try {
+      for (; i < capacity_; ++i) {
+        if (other.dist_[i] != 0) {
+          new (&slots_[i]) value_type(other.slots_[i]);
+          dist_[i] = other.dist_[i];
+        }
+      }
+    } catch (...) {
+      destroyAll();
+      ::operator delete(slots_);
+      delete[] dist_;
+      throw;
+    }
+  }
+
+  unordered_map &operator=(const unordered_map &other) {
+    if (this == &other) {
+      return *this;
+    }
+    unordered_map copy(other);
+    std::swap(slots_, copy.slots_);
+    std::swap(dist_, copy.dist_);
+    std::swap(capacity_, copy.capacity_);
+    std::swap(mask_, copy.mask_);
+    std::swap(shift_, copy.shift_);
+    std::swap(size_, copy.size_);
+    std::swap(map_compare_holder<Hash>::comp(),
+              copy.map_compare_holder<Hash>::comp());
+    std::swap(map_compare_holder<KeyEqual>::comp(),
+              copy.map_compare_holder<KeyEqual>::comp());
+    return *this;
+  }
+
+  ~unordered_map() {
+    destroyAll();
+    ::operator delete(slots_);
+    delete[] dist_;
+  }
+
+  /**
+   * access specified element with bounds checking
+   * Returns a reference to the mapped value of the element with key
+   * equivalent to key. If no such element exists, an exception of type
+   * `index_out_of_bound' is thrown.
+   */
+  T &at(const Key &key) {
+    size_t pos = findSlot(key);
+    if (pos == capacity_) {
+      throw index_out_of_bound();
+    }
+    return slots_[pos].second;
+  }
+  const T &at(const Key &key) const {
+    size_t pos = findSlot(key);
+    if (pos == capacity_) {
+      throw index_out_of_bound();
+    }
+    return slots_[pos].second;
+  }
+
+  /**
+   * access specified element
+   * Returns a reference to the value that is mapped to a key equivalent to
+   * key, performing an insertion if such key does not already exist.
+   */
+  T &operator[](const Key &key) { return tryEmplace(key).first->second; }
+  T &operator[](Key &&key) { return tryEmplace(std::move(key)).first->second; }
+  /*behave like at() throw index_out_of_bound if such key does not exist.*/
+  const T &operator[](const Key &key) const { return at(key); }
+
+  iterator begin() { return iterator(this, firstFrom(0)); }
+  const_iterator cbegin() const { return const_iterator(this, firstFrom(0)); }
+  iterator end() { return iterator(this, capacity_); }
+  const_iterator cend() const { return const_iterator(this, capacity_); }
+
+  bool empty() const { return size_ == 0; }
+
+  size_t size() const { return size_; }
+
+  /*Keeps the table, so refilling it to the same size rehashes nothing.*/
+  void clear() {
+    destroyAll();
+    for (size_t i = 0; i < capacity_; ++i) {
+      dist_[i] = 0;
+    }
+    size_ = 0;
+  }
+
+  /*Grow the table so that n elements fit without rehashing.*/
+  void reserve(size_t n) {
+    size_t capacity = capacity_;
+    while (n * 8 > capacity * 7) {
+      capacity *= 2;
+    }
+    if (capacity != capacity_) {
+      rehash(capacity);
+    }
+  }
+
+  /**
+   * insert an element.
+   * return a pair, the first of the pair is
+   *   the iterator to the new element (or the element that prevented the
+   * insertion), the second one is true if insert successfully, or false.
+   */
+  pair<iterator, bool> insert(const value_type &value) {
+    return emplaceKey(value.first, value);
+  }
+  pair<iterator, bool> insert(value_type &&value) {
+    const Key &key = value.first;
+    return emplaceKey(key, std::move(value));
+  }
+
+  /*Build the element from args only if key is missing.*/
+  template <class... Args>
+  pair<iterator, bool> try_emplace(const Key &key, Args &&...args) {
+    return tryEmplace(key, std::forward<Args>(args)...);
+  }
+  template <class... Args>
+  pair<iterator, bool> try_emplace(Key &&key, Args &&...args) {
+    return tryEmplace(std::move(key), std::forward<Args>(args)...);
+  }
+
+  /*Insert (key, obj), or assign obj to the element with key.*/
+  template <class M>
+  pair<iterator, bool> insert_or_assign(const Key &key, M &&obj) {
+    pair<iterator, bool> result = tryEmplace(key, std::forward<M>(obj));
+    if (!result.second) {
+      result.first->second = std::forward<M>(obj);
+    }
+    return result;
+  }
+
+  /**
+   * erase the element at pos.
+   *
+   * throw if pos pointed to a bad element (pos == this->end() || pos points
+   * an element out of this)
+   */
+  void erase(iterator pos) {
+    if (pos.it_ != this || pos.at_ >= capacity_ || dist_[pos.at_] == 0) {
+      throw invalid_iterator();
+    }
+    eraseAt(pos.at_);
+  }
+
+  /**
+   * erase the element with key, if there is one, and return the number of
+   * elements erased (0 or 1).
+   */
+  size_t erase(const Key &key) {
+    size_t pos = findSlot(key);
+    if (pos == capacity_) {
+      return 0;
+    }
+    eraseAt(pos);
+    return 1;
+  }
+
+  /**
+   * Returns the number of elements with key
+   *   that compares equivalent to the specified argument,
+   *   which is either 1 or 0
+   *     since this container does not allow duplicates.
+   */
+  size_t count(const Key &key) const { return findSlot(key) != capacity_; }
+
+  /**
+   * Finds an element with key equivalent to key.
+   * key value of the element to search for.
+   * Iterator to an element with key equivalent to key.
+   *   If no such element is found, past-the-end (see end()) iterator is
+   * returned.
+   */
+  iterator find(const Key &key) { return iterator(this, findSlot(key)); }
+  const_iterator find(const Key &key) const {
+    return const_iterator(this, findSlot(key));
+  }
+};
+
+} // namespace sjtu
+
+#endif
@@ -4,10 +4,39 @@
 #include <cstddef>
 #include <functional>
 #include <new>
+#include <type_traits>
 
 #include "exceptions.hpp"
+#include "utility.hpp"
 
 namespace sjtu {
+/*
+Keeps the comparator of a priority_queue. An empty (and not final) one is kept
+as a base class instead of a member, so that it takes no storage at all.
+*/
+template <class Compare, bool = std::is_empty<Compare>::value &&
+                                !std::is_final<Compare>::value>
+class priority_queue_compare_holder {
+   public:
+    priority_queue_compare_holder() : comp_() {}
+    explicit priority_queue_compare_holder(const Compare& comp) : comp_(comp) {}
+    const Compare& comp() const { return comp_; }
+    Compare& comp() { return comp_; }
+
+   private:
+    Compare comp_;
+};
+
+template <class Compare>
+class priority_queue_compare_holder<Compare, true> : private Compare {
+   public:
+    priority_queue_compare_holder() : Compare() {}
+    explicit priority_queue_compare_holder(const Compare& comp)
+        : Compare(comp) {}
+    const Compare& comp() const { return *this; }
+    Compare& comp() { return *this; }
+};
+
 /**
  * @brief a container like std::priority_queue which is a heap internal.
  * **Exception Safety**: The `Compare` operation might throw exceptions for
@@ -16,8 +45,15 @@ namespace sjtu {
  * operation began.
  */
 template <typename T, class Compare = std::less<T>>
-class priority_queue {
+class priority_queue : private priority_queue_compare_holder<Compare> {
    private:
+    /*
+    The comparator is stored once instead of built for every comparison, so
+    it may carry state; an empty one costs nothing, see
+    priority_queue_compare_holder.
+    */
+    using priority_queue_compare_holder<Compare>::comp;
+
     struct Node {
         Node* left_child_;
         Node* right_child_;
@@ -43,10 +79,6 @@ class priority_queue {
             delete content_;
         }
 
-        bool operator<(const Node& rhs) {
-            return Compare{}(*content_, *rhs.content_);
-        }
-
         void swap_child() {
             Node* temp = left_child_;
             left_child_ = right_child_;
@@ -58,12 +90,22 @@ class priority_queue {
     Node* root_;
     int node_num_;
 
+    bool less(const Node& lhs, const Node& rhs) const {
+        return comp()(*lhs.content_, *rhs.content_);
+    }
+
    public:
     priority_queue() {
         root_ = nullptr;
         node_num_ = 0;
     }
 
+    explicit priority_queue(const Compare& comp)
+        : priority_queue_compare_holder<Compare>(comp) {
+        root_ = nullptr;
+        node_num_ = 0;
+    }
+
     Node* copy(Node* src) {
         Node* des = new Node(*(src->content_));
         if (src->left_child_ != nullptr) {
@@ -80,7 +122,8 @@ class priority_queue {
         return des;
     }
 
-    priority_queue(const priority_queue& other) {
+    priority_queue(const priority_queue& other)
+        : priority_queue_compare_holder<Compare>(other.comp()) {
         root_ = copy(other.root_);
         node_num_ = other.node_num_;
     }
@@ -104,10 +147,11 @@ class priority_queue {
     }
 
     priority_queue& operator=(const priority_queue& other) {
-        if (root_ == other.root_) {
+        if (this == &other) {
             return *this;
         }
         erase(root_);
+        priority_queue_compare_holder<Compare>::comp() = other.comp();
         root_ = copy(other.root_);
         node_num_ = other.node_num_;
         return *this;
@@ -136,7 +180,7 @@ class priority_queue {
         }
         bool flag = 0;
         try {
-            flag = *rhs < *lhs;
+            flag = less(*rhs, *lhs);
         } catch (const sjtu::runtime_error& e) {
             throw sjtu::runtime_error();
             return lhs;